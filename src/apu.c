@@ -1,5 +1,6 @@
 #include "apu.h"
 
+#include <math.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -9,20 +10,243 @@
 
 byte duty_cycles[] = {0b11111110, 0b01111110, 0b01111000, 0b10000001};
 
+typedef enum {
+    RELOADS_BEFORE_DIV,
+    RELOADS_BEFORE_SAMPLE,
+    RELOADS_ALL
+} ReloadSet;
+
+// the differences of a band limited step, one row for each position of the
+// step between the last sample and the next
+static sword blip_steps[BLIP_PHASES + 1][BLIP_TAPS];
+
+static void apu_new_sample(APU* apu, dword time);
+static void apu_div_tick(APU* apu, dword time);
+static void psg_step(APU* apu, dword time);
+
+static void ch_reload(APU* apu, int ch, dword time) {
+    dword next_rel = 0;
+    switch (ch) {
+        case 0:
+            apu->ch1_duty_index++;
+            next_rel = (2048 - apu->ch1_wavelen) * 16;
+            break;
+        case 1:
+            apu->ch2_duty_index++;
+            next_rel = (2048 - apu->ch2_wavelen) * 16;
+            break;
+        case 2:
+            apu->ch3_sample_index++;
+            if (apu->ch3_sample_index % 32 == 0 && (apu->master->io.nr30 & (1 << 5))) {
+                waveram_swap(apu);
+            }
+            next_rel = (2048 - apu->ch3_wavelen) * 8;
+            break;
+        case 3: {
+            hword bit = (~(apu->ch4_lfsr ^ (apu->ch4_lfsr >> 1))) & 1;
+            apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 15)) | (bit << 15);
+            if (apu->master->io.nr43 & NR43_WIDTH) {
+                apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 7)) | (bit << 7);
+            }
+            apu->ch4_lfsr >>= 1;
+
+            int rate = 2 << ((apu->master->io.nr43 & NR43_SHIFT) >> 4);
+            if (apu->master->io.nr43 & NR43_DIV) {
+                rate *= apu->master->io.nr43 & NR43_DIV;
+            }
+            next_rel = 32 * rate;
+            break;
+        }
+    }
+
+    // anything at the same time as the last sample or div tick that is still
+    // being run must come after it
+    ChReload* r = &apu->ch_reload[ch];
+    r->time = time + next_rel;
+    r->sched_time = time;
+    r->after_sample = time == apu->last_sample;
+    r->after_div = time == apu->last_div;
+    r->active = true;
+}
+
+// a sample or div tick at t was scheduled by the one before it, or by
+// apu_enable for the first, so something due at t that was scheduled at
+// add_time runs after it if add_time is later than that, and if both were
+// scheduled at the same cycle the order they had then carries over
+//
+// e.g. the apu is enabled at 0 and timer 0 starts counting at 512 (its enable
+// event, added at 511) with a 512 cycle period: the sample at 512 was
+// scheduled at 0 and the enable event after that, so the enable runs after
+// the sample and schedules the overflow at 1024 with APU_AFTER_SAMPLE. the
+// sample at 1024 was scheduled at 512 too, by that sample, so the overflow
+// runs after it and pops the fifo after the old value was mixed. the overflow
+// it schedules at 1536 inherits the same order, and so on for every overflow
+static bool after_tick(APU* apu, dword t, dword add_time, byte add_order,
+                       dword period, byte bit) {
+    if (!(apu->master->io.nr52 & (1 << 7)) || t <= apu->enable_time ||
+        (t - apu->enable_time) % period) {
+        return true;
+    }
+    dword prev = t - period;
+    if (add_time != prev) return add_time > prev;
+    // the write enabling the apu comes after every event at that cycle
+    if (prev == apu->enable_time) return false;
+    return add_order & bit;
+}
+
+// only a timer overflow can reach the apu at the cycle it runs at, cpu code
+// and every other event come after everything at this cycle
+byte apu_order(APU* apu) {
+    if (apu->in_tm_event) return apu->tm_run_order;
+    return APU_AFTER_SAMPLE | APU_AFTER_DIV;
+}
+
+void apu_timer_scheduled(APU* apu, int i) {
+    apu->tm_add_time[i] = apu->master->sched.now;
+    apu->tm_add_order[i] = apu_order(apu);
+}
+
+void apu_timer_event_start(APU* apu, int i) {
+    dword t = apu->master->sched.now;
+    apu->tm_run_order =
+        (after_tick(apu, t, apu->tm_add_time[i], apu->tm_add_order[i],
+                    SAMPLE_PERIOD, APU_AFTER_SAMPLE)
+             ? APU_AFTER_SAMPLE
+             : 0) |
+        (after_tick(apu, t, apu->tm_add_time[i], apu->tm_add_order[i],
+                    APU_DIV_PERIOD, APU_AFTER_DIV)
+             ? APU_AFTER_DIV
+             : 0);
+    apu->in_tm_event = true;
+}
+
+void apu_timer_event_end(APU* apu) {
+    apu->in_tm_event = false;
+}
+
+// runs the channel timers due at t, one at the same cycle as a sample or div
+// tick runs before it only if it was scheduled first
+//
+// e.g. the cpu triggers ch2 at 512 with a 512 cycle period, just as a sample
+// runs there: cpu code comes after the sample so the reload at 1024 has
+// sched_time 512 == last_sample with after_sample set, and it is left for
+// RELOADS_ALL after the sample at 1024. had ch2 been reloaded at 511 by an
+// earlier reload instead it would be due at 1023 and not tie at all. only a
+// reload scheduled before the last tick, or at its cycle by something that ran
+// before it, runs before the next one
+static void run_reloads(APU* apu, dword t, ReloadSet set) {
+    for (int ch = 0; ch < 4; ch++) {
+        ChReload* r = &apu->ch_reload[ch];
+        if (!r->active || r->time != t) continue;
+        if (set == RELOADS_BEFORE_DIV &&
+            !(r->sched_time < apu->last_div ||
+              (r->sched_time == apu->last_div && !r->after_div))) {
+            continue;
+        }
+        if (set == RELOADS_BEFORE_SAMPLE &&
+            !(r->sched_time < apu->last_sample ||
+              (r->sched_time == apu->last_sample && !r->after_sample))) {
+            continue;
+        }
+        ch_reload(apu, ch, t);
+    }
+}
+
+static void apply_fifo_change(APU* apu, FifoChange* c) {
+    if (c->ch) apu->fifo_b_out = c->level;
+    else apu->fifo_a_out = c->level;
+}
+
+// runs everything in the apu up to the code running now, samples and div
+// ticks at this cycle only if they come before it
+static void apu_catch_up(APU* apu) {
+    dword now = apu->master->sched.now;
+    byte order = apu_order(apu);
+    bool on = apu->master->io.nr52 & (1 << 7);
+    int log_ind = 0;
+
+    if (on) psg_step(apu, apu->last_sync);
+    apu->last_sync = now;
+
+    while (true) {
+        dword t = on ? apu->last_sample + SAMPLE_PERIOD : -1;
+        for (int ch = 0; ch < 4; ch++) {
+            ChReload* r = &apu->ch_reload[ch];
+            if (r->active && r->time < t) t = r->time;
+        }
+        if (t > now) break;
+
+        if (on && t == apu->last_div + APU_DIV_PERIOD) {
+            run_reloads(apu, t, RELOADS_BEFORE_DIV);
+            if (t == now && !(order & APU_AFTER_DIV)) break;
+            apu_div_tick(apu, t);
+            psg_step(apu, t);
+        }
+        if (on && t == apu->last_sample + SAMPLE_PERIOD) {
+            run_reloads(apu, t, RELOADS_BEFORE_SAMPLE);
+            if (t == now && !(order & APU_AFTER_SAMPLE)) break;
+            while (log_ind < apu->fifo_log_len) {
+                FifoChange* c = &apu->fifo_log[log_ind];
+                if (c->time > t ||
+                    (c->time == t && (c->order & APU_AFTER_SAMPLE))) {
+                    break;
+                }
+                apply_fifo_change(apu, c);
+                log_ind++;
+            }
+            apu_new_sample(apu, t);
+        }
+        run_reloads(apu, t, RELOADS_ALL);
+        if (on) psg_step(apu, t);
+    }
+
+    for (; log_ind < apu->fifo_log_len; log_ind++) {
+        apply_fifo_change(apu, &apu->fifo_log[log_ind]);
+    }
+    apu->fifo_log_len = 0;
+}
+
+// anything outside the apu that looks at or changes its state has to call
+// this first
+void apu_sync(APU* apu) {
+    apu_catch_up(apu);
+}
+
+static void schedule_flush(APU* apu) {
+    dword left = (SAMPLE_BUF_LEN - apu->sample_ind) / 2;
+    // one cycle late so the last sample is never waiting on an event at the
+    // same cycle
+    add_event(&apu->master->sched, EVENT_APU_FLUSH,
+              apu->last_sample + left * SAMPLE_PERIOD + 1);
+}
+
+// fills the sample buffer up so the frontend can take it
+void apu_flush(APU* apu) {
+    apu_catch_up(apu);
+    schedule_flush(apu);
+}
+
+void apu_trigger_reload(APU* apu, int ch) {
+    ch_reload(apu, ch, apu->master->sched.now);
+}
+
 void apu_enable(APU* apu) {
-    add_event(&apu->master->sched, EVENT_APU_SAMPLE, apu->master->sched.now + SAMPLE_PERIOD);
-    add_event(&apu->master->sched, EVENT_APU_DIV_TICK, apu->master->sched.now + APU_DIV_PERIOD);
+    apu->enable_time = apu->master->sched.now;
+    apu->last_sample = apu->master->sched.now;
+    apu->last_div = apu->master->sched.now;
+    memset(apu->blip, 0, sizeof apu->blip);
+    memset(apu->blip_sum, 0, sizeof apu->blip_sum);
+    memset(apu->psg_level, 0, sizeof apu->psg_level);
+    memset(apu->direct_level, 0, sizeof apu->direct_level);
+    apu->blip_ind = 0;
+    schedule_flush(apu);
 }
 
 void apu_disable(APU* apu) {
     apu->apu_div = 0;
     apu->sample_ind = 0;
-    remove_event(&apu->master->sched, EVENT_APU_SAMPLE);
-    remove_event(&apu->master->sched, EVENT_APU_CH1_REL);
-    remove_event(&apu->master->sched, EVENT_APU_CH2_REL);
-    remove_event(&apu->master->sched, EVENT_APU_CH3_REL);
-    remove_event(&apu->master->sched, EVENT_APU_CH4_REL);
-    remove_event(&apu->master->sched, EVENT_APU_DIV_TICK);
+    remove_event(&apu->master->sched, EVENT_APU_FLUSH);
+    for (int ch = 0; ch < 4; ch++) apu->ch_reload[ch].active = false;
 }
 
 static inline shword get_sample_ch1(APU* apu) {
@@ -62,11 +286,46 @@ static inline shword get_sample_ch4(APU* apu) {
     return (apu->ch4_lfsr & 1) ? apu->ch4_volume : -apu->ch4_volume;
 }
 
-void apu_new_sample(APU* apu) {
-    apu->master->io.nr52 = 0b10000000 | (apu->ch1_enable ? 0b0001 : 0) |
-                           (apu->ch2_enable ? 0b0010 : 0) | (apu->ch3_enable ? 0b0100 : 0) |
-                           (apu->ch4_enable ? 0b1000 : 0);
+static double blip_impulse(double x) {
+    // cut off a little below the nyquist frequency, the window takes care
+    // of the rest
+    const double cutoff = 0.85;
+    double w = x / (BLIP_TAPS / 2);
+    if (w * w >= 1) return 0;
+    double y = M_PI * cutoff * x;
+    double sinc = y == 0 ? 1 : sin(y) / y;
+    double window = 0.42 + 0.5 * cos(M_PI * w) + 0.08 * cos(2 * M_PI * w);
+    return cutoff * sinc * window;
+}
+
+// a blackman windowed sinc step, tap k of a row is the part of the step that
+// happens during sample k after the step, a step right at the next sample is
+// centered BLIP_DELAY taps in
+void apu_generate_blip() {
+    for (int p = 0; p <= BLIP_PHASES; p++) {
+        double center = BLIP_DELAY - 1 + (double) p / BLIP_PHASES;
+        double taps[BLIP_TAPS];
+        double sum = 0;
+        for (int k = 0; k < BLIP_TAPS; k++) {
+            taps[k] = 0;
+            for (int j = 0; j < 16; j++) {
+                taps[k] += blip_impulse(k - 1 - center + (j + 0.5) / 16) / 16;
+            }
+            sum += taps[k];
+        }
+        int total = 0, peak = 0;
+        for (int k = 0; k < BLIP_TAPS; k++) {
+            blip_steps[p][k] = lround(taps[k] / sum * 0x8000);
+            total += blip_steps[p][k];
+            if (blip_steps[p][k] > blip_steps[p][peak]) peak = k;
+        }
+        // the sum of the output only comes back to where it should be if
+        // every step adds up to exactly its size
+        blip_steps[p][peak] += 0x8000 - total;
+    }
+}
 
+static void psg_mix(APU* apu, shword* level) {
     shword ch1_sample = apu->ch1_enable ? get_sample_ch1(apu) : 0;
     shword ch2_sample = apu->ch2_enable ? get_sample_ch2(apu) : 0;
     shword ch3_sample = apu->ch3_enable ? get_sample_ch3(apu) : 0;
@@ -87,8 +346,41 @@ void apu_new_sample(APU* apu) {
     l_sample >>= 2 - apu->master->io.soundcnth.gb_volume;
     r_sample >>= 2 - apu->master->io.soundcnth.gb_volume;
 
-    shword cha_sample = apu->fifo_a[0] * 2;
-    shword chb_sample = apu->fifo_b[0] * 2;
+    level[0] = l_sample;
+    level[1] = r_sample;
+}
+
+// adds a step for anything that changed the psg level since the last step,
+// time is never more than a sample past the last one
+static void psg_step(APU* apu, dword time) {
+    shword level[2];
+    psg_mix(apu, level);
+    if (level[0] == apu->psg_level[0] && level[1] == apu->psg_level[1]) return;
+
+    dword ofs = time - apu->last_sample;
+    if (ofs > SAMPLE_PERIOD) ofs = SAMPLE_PERIOD;
+    int phase = (ofs * BLIP_PHASES + SAMPLE_PERIOD / 2) / SAMPLE_PERIOD;
+    sword* row = blip_steps[phase];
+    for (int c = 0; c < 2; c++) {
+        sword delta = level[c] - apu->psg_level[c];
+        if (!delta) continue;
+        for (int k = 0; k < BLIP_TAPS; k++) {
+            apu->blip[c][(apu->blip_ind + k) % BLIP_LEN] += delta * row[k];
+        }
+        apu->psg_level[c] = level[c];
+    }
+}
+
+static void apu_new_sample(APU* apu, dword time) {
+    apu->master->io.nr52 = 0b10000000 | (apu->ch1_enable ? 0b0001 : 0) |
+                           (apu->ch2_enable ? 0b0010 : 0) | (apu->ch3_enable ? 0b0100 : 0) |
+                           (apu->ch4_enable ? 0b1000 : 0);
+
+    psg_step(apu, time);
+
+    shword l_sample = 0, r_sample = 0;
+    shword cha_sample = apu->fifo_a_out * 2;
+    shword chb_sample = apu->fifo_b_out * 2;
     if (apu->master->io.soundcnth.cha_volume) cha_sample *= 2;
     if (apu->master->io.soundcnth.chb_volume) chb_sample *= 2;
     if (apu->master->io.soundcnth.cha_ena_left) l_sample += cha_sample;
@@ -99,58 +391,31 @@ void apu_new_sample(APU* apu) {
     l_sample += apu->master->io.soundbias.bias - 0x200;
     r_sample += apu->master->io.soundbias.bias - 0x200;
 
-    if (l_sample < -0x200) l_sample = -0x200;
-    if (r_sample < -0x200) r_sample = -0x200;
-    if (l_sample >= 0x200) l_sample = 0x1ff;
-    if (r_sample >= 0x200) r_sample = 0x1ff;
+    // the fifos only change at samples so they are not band limited, they
+    // go in as whole steps at the same delay as the psg
+    shword direct[2] = {l_sample, r_sample};
+    for (int c = 0; c < 2; c++) {
+        apu->blip[c][(apu->blip_ind + BLIP_DELAY) % BLIP_LEN] +=
+            (direct[c] - apu->direct_level[c]) * 0x8000;
+        apu->direct_level[c] = direct[c];
+
+        apu->blip_sum[c] += apu->blip[c][apu->blip_ind];
+        apu->blip[c][apu->blip_ind] = 0;
+        float out = (float) apu->blip_sum[c] / 0x8000;
+        if (out < -0x200) out = -0x200;
+        if (out > 0x1ff) out = 0x1ff;
+        apu->sample_buf[apu->sample_ind++] = out / 0x200;
+    }
+    apu->blip_ind = (apu->blip_ind + 1) % BLIP_LEN;
 
-    apu->sample_buf[apu->sample_ind++] = (float) l_sample / 0x200;
-    apu->sample_buf[apu->sample_ind++] = (float) r_sample / 0x200;
     if (apu->sample_ind == SAMPLE_BUF_LEN) {
         apu->samples_full = true;
         apu->sample_ind = 0;
     }
-
-    add_event(&apu->master->sched, EVENT_APU_SAMPLE, apu->master->sched.now + SAMPLE_PERIOD);
-}
-
-void ch1_reload(APU* apu) {
-    apu->ch1_duty_index++;
-    dword next_rel = (2048 - apu->ch1_wavelen) * 16;
-    add_event(&apu->master->sched, EVENT_APU_CH1_REL, apu->master->sched.now + next_rel);
-}
-
-void ch2_reload(APU* apu) {
-    apu->ch2_duty_index++;
-    dword next_rel = (2048 - apu->ch2_wavelen) * 16;
-    add_event(&apu->master->sched, EVENT_APU_CH2_REL, apu->master->sched.now + next_rel);
-}
-
-void ch3_reload(APU* apu) {
-    apu->ch3_sample_index++;
-    if (apu->ch3_sample_index % 32 == 0 && (apu->master->io.nr30 & (1 << 5))) {
-        waveram_swap(apu);
-    }
-    dword next_rel = (2048 - apu->ch3_wavelen) * 8;
-    add_event(&apu->master->sched, EVENT_APU_CH3_REL, apu->master->sched.now + next_rel);
+    apu->last_sample = time;
 }
 
-void ch4_reload(APU* apu) {
-    hword bit = (~(apu->ch4_lfsr ^ (apu->ch4_lfsr >> 1))) & 1;
-    apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 15)) | (bit << 15);
-    if (apu->master->io.nr43 & NR43_WIDTH) {
-        apu->ch4_lfsr = (apu->ch4_lfsr & ~(1 << 7)) | (bit << 7);
-    }
-    apu->ch4_lfsr >>= 1;
-
-    int rate = 2 << ((apu->master->io.nr43 & NR43_SHIFT) >> 4);
-    if (apu->master->io.nr43 & NR43_DIV) {
-        rate *= apu->master->io.nr43 & NR43_DIV;
-    }
-    add_event(&apu->master->sched, EVENT_APU_CH4_REL, apu->master->sched.now + 32 * rate);
-}
-
-void apu_div_tick(APU* apu) {
+static void apu_div_tick(APU* apu, dword time) {
     apu->apu_div++;
 
     if (apu->apu_div % 2 == 0) {
@@ -159,7 +424,7 @@ void apu_div_tick(APU* apu) {
             if (apu->ch1_len_counter == 64) {
                 apu->ch1_len_counter = 0;
                 apu->ch1_enable = false;
-                remove_event(&apu->master->sched, EVENT_APU_CH1_REL);
+                apu->ch_reload[0].active = false;
             }
         }
 
@@ -168,7 +433,7 @@ void apu_div_tick(APU* apu) {
             if (apu->ch2_len_counter == 64) {
                 apu->ch2_len_counter = 0;
                 apu->ch2_enable = false;
-                remove_event(&apu->master->sched, EVENT_APU_CH2_REL);
+                apu->ch_reload[1].active = false;
             }
         }
 
@@ -176,7 +441,7 @@ void apu_div_tick(APU* apu) {
             apu->ch3_len_counter++;
             if (apu->ch3_len_counter == 0) {
                 apu->ch3_enable = false;
-                remove_event(&apu->master->sched, EVENT_APU_CH3_REL);
+                apu->ch_reload[2].active = false;
             }
         }
 
@@ -185,7 +450,7 @@ void apu_div_tick(APU* apu) {
             if (apu->ch4_len_counter == 64) {
                 apu->ch4_len_counter = 0;
                 apu->ch4_enable = false;
-                remove_event(&apu->master->sched, EVENT_APU_CH4_REL);
+                apu->ch_reload[3].active = false;
             }
         }
     }
@@ -202,7 +467,7 @@ void apu_div_tick(APU* apu) {
                 new_wvlen += del_wvlen;
                 if (new_wvlen > 2047) {
                     apu->ch1_enable = false;
-                    remove_event(&apu->master->sched, EVENT_APU_CH1_REL);
+                    apu->ch_reload[0].active = false;
                 }
             }
             if (apu->master->io.nr10 & NR10_SLOP) apu->ch1_wavelen = new_wvlen;
@@ -245,8 +510,7 @@ void apu_div_tick(APU* apu) {
             }
         }
     }
-
-    add_event(&apu->master->sched, EVENT_APU_DIV_TICK, apu->master->sched.now + APU_DIV_PERIOD);
+    apu->last_div = time;
 }
 
 void waveram_swap(APU* apu) {
@@ -256,15 +520,34 @@ void waveram_swap(APU* apu) {
     memcpy(apu->master->io.waveram, tmp, sizeof tmp);
 }
 
+static void log_fifo(APU* apu, int ch, sbyte level) {
+    // nothing is mixed while the apu is off, turning it off synced the log
+    if (!(apu->master->io.nr52 & (1 << 7))) {
+        FifoChange c = {.ch = ch, .level = level};
+        apply_fifo_change(apu, &c);
+        return;
+    }
+    if (apu->fifo_log_len == FIFO_LOG_LEN) apu_catch_up(apu);
+    FifoChange* c = &apu->fifo_log[apu->fifo_log_len++];
+    c->time = apu->master->sched.now;
+    c->order = apu_order(apu);
+    c->ch = ch;
+    c->level = level;
+}
+
 void fifo_a_push(APU* apu, word samples) {
     for (int i = 0; i < 4; i++, samples >>= 8) {
         if (apu->fifo_a_size == 32) fifo_a_pop(apu);
+        if (apu->fifo_a_size == 0 && apu->fifo_a[0] != (sbyte) samples) {
+            log_fifo(apu, 0, samples);
+        }
         apu->fifo_a[apu->fifo_a_size++] = samples & 0xff;
     }
 }
 
 void fifo_a_pop(APU* apu) {
     if (apu->fifo_a_size <= 1) return;
+    if (apu->fifo_a[1] != apu->fifo_a[0]) log_fifo(apu, 0, apu->fifo_a[1]);
     apu->fifo_a_size--;
     for (int i = 0; i < apu->fifo_a_size; i++) {
         apu->fifo_a[i] = apu->fifo_a[i + 1];
@@ -274,12 +557,16 @@ void fifo_a_pop(APU* apu) {
 void fifo_b_push(APU* apu, word samples) {
     for (int i = 0; i < 4; i++, samples >>= 8) {
         if (apu->fifo_b_size == 32) fifo_b_pop(apu);
+        if (apu->fifo_b_size == 0 && apu->fifo_b[0] != (sbyte) samples) {
+            log_fifo(apu, 1, samples);
+        }
         apu->fifo_b[apu->fifo_b_size++] = samples & 0xff;
     }
 }
 
 void fifo_b_pop(APU* apu) {
     if (apu->fifo_b_size <= 1) return;
+    if (apu->fifo_b[1] != apu->fifo_b[0]) log_fifo(apu, 1, apu->fifo_b[1]);
     apu->fifo_b_size--;
     for (int i = 0; i < apu->fifo_b_size; i++) {
         apu->fifo_b[i] = apu->fifo_b[i + 1];
@@ -9,6 +9,17 @@
 #define SAMPLE_PERIOD ((1 << 24) / SAMPLE_FREQ)
 #define SAMPLE_BUF_LEN 1024
 
+// the psg channels change level at any cycle, each change is mixed in as a
+// band limited step spread over BLIP_TAPS samples so nothing above the
+// nyquist frequency aliases, placed at one of BLIP_PHASES positions between
+// two samples
+#define BLIP_TAPS 32
+#define BLIP_PHASES 64
+// everything comes out this many samples late so a step can start early
+#define BLIP_DELAY (BLIP_TAPS / 2)
+// must be a power of 2 and at least BLIP_TAPS
+#define BLIP_LEN 64
+
 enum { NRX1_LEN = 0b00111111, NRX1_DUTY = 0b11000000 };
 
 enum { NRX2_PACE = 0b00000111, NRX2_DIR = 1 << 3, NRX2_VOL = 0b11110000 };
@@ -21,17 +32,73 @@ enum { NR10_SLOP = 0b00000111, NR10_DIR = 1 << 3, NR10_PACE = 0b01110000 };
 
 enum { NR43_DIV = 0b00000111, NR43_WIDTH = 1 << 3, NR43_SHIFT = 0b11110000 };
 
+// fifo changes waiting to be mixed
+#define FIFO_LOG_LEN 64
+
 typedef struct _GBA GBA;
 
+// the apu has no events of its own besides handing off the sample buffer, the
+// samples, div ticks and channel timers are run when something could see or
+// change their state, in the same order the scheduler would have run them
+//
+// apu_order says whether the code running now comes after the sample and div
+// tick due at this cycle
+enum { APU_AFTER_SAMPLE = 1 << 0, APU_AFTER_DIV = 1 << 1 };
+
+typedef struct {
+    dword time;
+    dword sched_time;
+    bool after_sample;
+    bool after_div;
+    bool active;
+} ChReload;
+
+// a new value at the head of a fifo, the mixer only needs to know when it
+// changed so pops and pushes are logged instead of synced
+typedef struct {
+    dword time;
+    byte order;
+    byte ch;
+    sbyte level;
+} FifoChange;
+
 typedef struct {
     GBA* master;
 
     hword apu_div;
 
+    ChReload ch_reload[4];
+    dword enable_time;
+    dword last_sample;
+    dword last_div;
+
+    // when each timer overflow was scheduled and its order then, timer
+    // overflows are the only events that touch the apu before time moves
+    dword tm_add_time[4];
+    byte tm_add_order[4];
+    byte tm_run_order;
+    bool in_tm_event;
+
+    FifoChange fifo_log[FIFO_LOG_LEN];
+    int fifo_log_len;
+    sbyte fifo_a_out;
+    sbyte fifo_b_out;
+
     float sample_buf[SAMPLE_BUF_LEN];
     int sample_ind;
     bool samples_full;
 
+    // steps waiting to be summed into the output, 0x8000 per level
+    sword blip[2][BLIP_LEN];
+    sword blip_sum[2];
+    byte blip_ind;
+    // the levels the steps so far add up to, the psg and the fifos and bias
+    // which are stepped straight at each sample
+    shword psg_level[2];
+    shword direct_level[2];
+    // outside writes to the psg all happen right after a sync
+    dword last_sync;
+
     bool ch1_enable;
     hword ch1_wavelen;
     byte ch1_duty_index;
@@ -73,15 +140,19 @@ typedef struct {
     byte fifo_b_size;
 } APU;
 
+void apu_generate_blip();
+
 void apu_enable(APU* apu);
 void apu_disable(APU* apu);
 
-void apu_new_sample(APU* apu);
+byte apu_order(APU* apu);
+void apu_timer_scheduled(APU* apu, int i);
+void apu_timer_event_start(APU* apu, int i);
+void apu_timer_event_end(APU* apu);
 
-void ch1_reload(APU* apu);
-void ch2_reload(APU* apu);
-void ch3_reload(APU* apu);
-void ch4_reload(APU* apu);
+void apu_sync(APU* apu);
+void apu_flush(APU* apu);
+void apu_trigger_reload(APU* apu, int ch);
 
 void waveram_swap(APU* apu);
 
@@ -91,8 +162,4 @@ void fifo_a_pop(APU* apu);
 void fifo_b_push(APU* apu, word samples);
 void fifo_b_pop(APU* apu);
 
-void apu_div_tick(APU* apu);
-
-void tick_apu(APU* apu);
-
 #endif
\ No newline at end of file
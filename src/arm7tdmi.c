@@ -12,14 +12,48 @@ void cpu_step(Arm7TDMI* cpu) {
     arm_exec_instr(cpu);
 }
 
+static inline ArmInstr cpu_fetch_thumb(Arm7TDMI* cpu, word addr, bool seq) {
+    GBA* gba = cpu->master;
+    tick_components(gba, get_fetch_waitstates_fast(gba, addr, false, seq),
+                    true);
+    Block* b = bcache_lookup(gba, &gba->bcache, addr, true);
+    if (!b) return thumb_lookup[cpu_fetchh_bus(cpu, addr)];
+
+    hword data = b->thumb_raw[gba->bcache.cur_index];
+    gba->openbus = false;
+    if (addr < BIOS_SIZE) gba->last_bios_val = gba->bios.w[addr >> 2];
+    word reg = addr >> 24;
+    if (reg == R_BIOS || reg == R_IWRAM) {
+        cpu->bus_val &= 0x0000ffff << (16 * (~addr & 1));
+        cpu->bus_val |= data << (16 * (addr & 1));
+    } else cpu->bus_val = data * 0x00010001;
+    bus_unlock(gba, 5);
+    return b->instrs[gba->bcache.cur_index];
+}
+
+static inline ArmInstr cpu_fetch_arm(Arm7TDMI* cpu, word addr, bool seq) {
+    GBA* gba = cpu->master;
+    tick_components(gba, get_fetch_waitstates_fast(gba, addr, true, seq),
+                    true);
+    Block* b = bcache_lookup(gba, &gba->bcache, addr, false);
+    if (!b) return (ArmInstr){cpu_fetchw_bus(cpu, addr)};
+
+    ArmInstr instr = b->instrs[gba->bcache.cur_index];
+    gba->openbus = false;
+    if (addr < BIOS_SIZE) gba->last_bios_val = instr.w;
+    cpu->bus_val = instr.w;
+    bus_unlock(gba, 5);
+    return instr;
+}
+
 void cpu_fetch_instr(Arm7TDMI* cpu) {
     cpu->cur_instr = cpu->next_instr;
     if (cpu->cpsr.t) {
-        cpu->next_instr = thumb_lookup[cpu_fetchh(cpu, cpu->pc, cpu->next_seq)];
+        cpu->next_instr = cpu_fetch_thumb(cpu, cpu->pc, cpu->next_seq);
         cpu->pc += 2;
         cpu->cur_instr_addr += 2;
     } else {
-        cpu->next_instr.w = cpu_fetchw(cpu, cpu->pc, cpu->next_seq);
+        cpu->next_instr = cpu_fetch_arm(cpu, cpu->pc, cpu->next_seq);
         cpu->pc += 4;
         cpu->cur_instr_addr += 4;
     }
@@ -30,16 +64,16 @@ void cpu_flush(Arm7TDMI* cpu) {
     if (cpu->cpsr.t) {
         cpu->pc &= ~1;
         cpu->cur_instr_addr = cpu->pc;
-        cpu->cur_instr = thumb_lookup[cpu_fetchh(cpu, cpu->pc, false)];
+        cpu->cur_instr = cpu_fetch_thumb(cpu, cpu->pc, false);
         cpu->pc += 2;
-        cpu->next_instr = thumb_lookup[cpu_fetchh(cpu, cpu->pc, true)];
+        cpu->next_instr = cpu_fetch_thumb(cpu, cpu->pc, true);
         cpu->pc += 2;
     } else {
         cpu->pc &= ~0b11;
         cpu->cur_instr_addr = cpu->pc;
-        cpu->cur_instr.w = cpu_fetchw(cpu, cpu->pc, false);
+        cpu->cur_instr = cpu_fetch_arm(cpu, cpu->pc, false);
         cpu->pc += 4;
-        cpu->next_instr.w = cpu_fetchw(cpu, cpu->pc, true);
+        cpu->next_instr = cpu_fetch_arm(cpu, cpu->pc, true);
         cpu->pc += 4;
     }
     cpu->next_seq = true;
@@ -204,9 +238,7 @@ void cpu_writem(Arm7TDMI* cpu, word addr, int i, word w) {
     bus_unlock(cpu->master, 5);
 }
 
-hword cpu_fetchh(Arm7TDMI* cpu, word addr, bool seq) {
-    tick_components(cpu->master,
-                    get_fetch_waitstates(cpu->master, addr, false, seq), true);
+hword cpu_fetchh_bus(Arm7TDMI* cpu, word addr) {
     word data = bus_readh(cpu->master, addr);
     if (cpu->master->openbus) data = cpu->bus_val;
     else {
@@ -220,9 +252,7 @@ hword cpu_fetchh(Arm7TDMI* cpu, word addr, bool seq) {
     return data;
 }
 
-word cpu_fetchw(Arm7TDMI* cpu, word addr, bool seq) {
-    tick_components(cpu->master,
-                    get_fetch_waitstates(cpu->master, addr, true, seq), true);
+word cpu_fetchw_bus(Arm7TDMI* cpu, word addr) {
     word data = bus_readw(cpu->master, addr);
     if (cpu->master->openbus) data = cpu->bus_val;
     else cpu->bus_val = data;
@@ -230,6 +260,18 @@ word cpu_fetchw(Arm7TDMI* cpu, word addr, bool seq) {
     return data;
 }
 
+hword cpu_fetchh(Arm7TDMI* cpu, word addr, bool seq) {
+    tick_components(cpu->master,
+                    get_fetch_waitstates(cpu->master, addr, false, seq), true);
+    return cpu_fetchh_bus(cpu, addr);
+}
+
+word cpu_fetchw(Arm7TDMI* cpu, word addr, bool seq) {
+    tick_components(cpu->master,
+                    get_fetch_waitstates(cpu->master, addr, true, seq), true);
+    return cpu_fetchw_bus(cpu, addr);
+}
+
 byte cpu_swapb(Arm7TDMI* cpu, word addr, byte b) {
     bus_lock(cpu->master);
     tick_components(cpu->master,
@@ -84,6 +84,8 @@ void cpu_writem(Arm7TDMI* cpu, word addr, int i, word w);
 byte cpu_swapb(Arm7TDMI* cpu, word addr, byte data);
 word cpu_swapw(Arm7TDMI* cpu, word addr, word data);
 
+hword cpu_fetchh_bus(Arm7TDMI* cpu, word addr);
+word cpu_fetchw_bus(Arm7TDMI* cpu, word addr);
 hword cpu_fetchh(Arm7TDMI* cpu, word addr, bool seq);
 word cpu_fetchw(Arm7TDMI* cpu, word addr, bool seq);
 
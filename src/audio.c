@@ -0,0 +1,152 @@
+#include "audio.h"
+
+#include <math.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct _AudioBuffer {
+    // single producer single consumer ring, head is only written by the
+    // emulation thread and tail by the audio thread
+    float ring[AUDIO_RING_LEN][2];
+    atomic_uint head;
+    atomic_uint tail;
+
+    // only touched by the emulation thread
+    double base_ratio;
+    double avg_fill;
+    double pos;
+    // each input sample is written twice so the last AUDIO_TAPS samples are
+    // always contiguous
+    float hist[2][2 * AUDIO_TAPS];
+    int hist_ind;
+
+    // one extra phase so neighbouring phases can be blended without wrapping
+    float coefs[AUDIO_PHASES + 1][AUDIO_TAPS];
+
+    // only touched by the audio thread
+    bool primed;
+} AudioBuffer;
+
+static double bessel_i0(double x) {
+    double sum = 1, term = 1;
+    for (int k = 1; k < 32; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+    }
+    return sum;
+}
+
+// kaiser windowed sinc, cut off a little below the lower of the two nyquist
+// frequencies so resampling adds no aliasing of its own
+static void init_filter(AudioBuffer* a) {
+    const double beta = 8;
+    double cutoff = 0.9 * (a->base_ratio < 1 ? a->base_ratio : 1);
+    for (int p = 0; p <= AUDIO_PHASES; p++) {
+        double frac = (double) p / AUDIO_PHASES;
+        double sum = 0;
+        for (int k = 0; k < AUDIO_TAPS; k++) {
+            double d = k + 1 - AUDIO_TAPS / 2 - frac;
+            double x = M_PI * cutoff * d;
+            double sinc = x == 0 ? 1 : sin(x) / x;
+            double w = d / (AUDIO_TAPS / 2);
+            double window = 0;
+            if (w * w < 1) {
+                window = bessel_i0(beta * sqrt(1 - w * w)) / bessel_i0(beta);
+            }
+            a->coefs[p][k] = sinc * window;
+            sum += sinc * window;
+        }
+        for (int k = 0; k < AUDIO_TAPS; k++) a->coefs[p][k] /= sum;
+    }
+}
+
+AudioBuffer* create_audio_buffer(int in_rate, int out_rate) {
+    AudioBuffer* a = calloc(1, sizeof *a);
+    a->base_ratio = (double) out_rate / in_rate;
+    a->avg_fill = AUDIO_LATENCY;
+    init_filter(a);
+    return a;
+}
+
+void destroy_audio_buffer(AudioBuffer* a) {
+    free(a);
+}
+
+// split into lanes so the compiler can vectorize it without reordering the
+// float additions
+static float dot(float* c, float* x) {
+    float acc[8] = {0};
+    for (int k = 0; k < AUDIO_TAPS; k += 8) {
+        for (int j = 0; j < 8; j++) acc[j] += c[k + j] * x[k + j];
+    }
+    return ((acc[0] + acc[1]) + (acc[2] + acc[3])) +
+           ((acc[4] + acc[5]) + (acc[6] + acc[7]));
+}
+
+void audio_push(AudioBuffer* a, float* samples, int len) {
+    unsigned head = atomic_load_explicit(&a->head, memory_order_relaxed);
+    unsigned tail = atomic_load_explicit(&a->tail, memory_order_acquire);
+
+    // the fill level jumps by a whole device buffer every callback so only
+    // follow it slowly
+    a->avg_fill += ((double) (head - tail) - a->avg_fill) / 16;
+    double delta = (AUDIO_LATENCY - a->avg_fill) / AUDIO_LATENCY;
+    if (delta > 1) delta = 1;
+    if (delta < -1) delta = -1;
+    double step = 1 / (a->base_ratio * (1 + AUDIO_MAX_DELTA * delta));
+
+    for (int i = 0; i < len; i += 2) {
+        for (int c = 0; c < 2; c++) {
+            a->hist[c][a->hist_ind] = samples[i + c];
+            a->hist[c][a->hist_ind + AUDIO_TAPS] = samples[i + c];
+        }
+        a->hist_ind = (a->hist_ind + 1) % AUDIO_TAPS;
+
+        // outputs land between the two samples in the middle of the window
+        while (a->pos < 1) {
+            // drop anything that does not fit, the rate control should keep
+            // this from happening
+            if (head - tail < AUDIO_RING_LEN) {
+                double ph = a->pos * AUDIO_PHASES;
+                int p = ph;
+                float t = ph - p;
+                float* out = a->ring[head % AUDIO_RING_LEN];
+                for (int c = 0; c < 2; c++) {
+                    float* x = &a->hist[c][a->hist_ind];
+                    float s0 = dot(a->coefs[p], x);
+                    float s1 = dot(a->coefs[p + 1], x);
+                    out[c] = s0 + (s1 - s0) * t;
+                }
+                head++;
+            }
+            a->pos += step;
+        }
+        a->pos -= 1;
+    }
+
+    atomic_store_explicit(&a->head, head, memory_order_release);
+}
+
+void audio_pull(AudioBuffer* a, float* samples, int len) {
+    unsigned tail = atomic_load_explicit(&a->tail, memory_order_relaxed);
+    unsigned head = atomic_load_explicit(&a->head, memory_order_acquire);
+    unsigned avail = head - tail;
+    unsigned frames = len / 2;
+
+    if (!a->primed && avail < AUDIO_LATENCY) {
+        memset(samples, 0, len * sizeof *samples);
+        return;
+    }
+    a->primed = avail >= frames;
+    if (frames > avail) frames = avail;
+
+    for (unsigned i = 0; i < frames; i++) {
+        float* in = a->ring[(tail + i) % AUDIO_RING_LEN];
+        samples[2 * i] = in[0];
+        samples[2 * i + 1] = in[1];
+    }
+    memset(&samples[2 * frames], 0, (len - 2 * frames) * sizeof *samples);
+
+    atomic_store_explicit(&a->tail, tail + frames, memory_order_release);
+}
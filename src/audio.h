@@ -0,0 +1,30 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include "types.h"
+
+// stereo frames, must be a power of 2
+#define AUDIO_RING_LEN 4096
+// frames the ring is kept filled to, the playback latency on top of the device
+#define AUDIO_LATENCY 1024
+// largest change to the resampling ratio the rate control makes
+#define AUDIO_MAX_DELTA 0.005
+
+// band limited resampling filter, every output sample is a dot product of
+// AUDIO_TAPS input samples with one of AUDIO_PHASES sets of coefficients
+#define AUDIO_TAPS 32
+#define AUDIO_PHASES 256
+
+typedef struct _AudioBuffer AudioBuffer;
+
+AudioBuffer* create_audio_buffer(int in_rate, int out_rate);
+void destroy_audio_buffer(AudioBuffer* a);
+
+// called from the emulation thread with interleaved stereo samples like the
+// apu sample buffer, the ratio is nudged so the ring stays at AUDIO_LATENCY
+void audio_push(AudioBuffer* a, float* samples, int len);
+// called from the audio thread, outputs silence until the ring has filled up
+// again after running dry
+void audio_pull(AudioBuffer* a, float* samples, int len);
+
+#endif
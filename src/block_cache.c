@@ -0,0 +1,76 @@
+#include "block_cache.h"
+
+#include "gba.h"
+#include "thumb_isa.h"
+
+void bcache_reset(BlockCache* bc) {
+    for (int i = 0; i < BLOCK_CACHE_SIZE; i++) {
+        bc->blocks[i].valid = false;
+    }
+    bc->cur = 0;
+    bc->cur_index = 0;
+    bc->next_key = BLOCK_KEY_NONE;
+}
+
+bool bcache_build(GBA* gba, Block* b, word addr, bool thumb) {
+    byte* mem;
+    word ofs;
+    word limit = -1;
+    hword page = BLOCK_PAGE_RO;
+    switch (addr >> 24) {
+        case R_BIOS:
+            if (addr >= BIOS_SIZE) return false;
+            mem = gba->bios.b;
+            ofs = addr;
+            break;
+        case R_EWRAM:
+            mem = gba->ewram.b;
+            ofs = addr % EWRAM_SIZE;
+            page = BLOCK_PAGE_EWRAM + (ofs >> BLOCK_PAGE_BITS);
+            break;
+        case R_IWRAM:
+            mem = gba->iwram.b;
+            ofs = addr % IWRAM_SIZE;
+            page = BLOCK_PAGE_IWRAM + (ofs >> BLOCK_PAGE_BITS);
+            break;
+        case R_ROM0:
+        case R_ROM0EX:
+        case R_ROM1:
+        case R_ROM1EX:
+        case R_ROM2:
+        case R_ROM2EX:
+            mem = gba->cart->rom.b;
+            ofs = addr % (1 << 25);
+            limit = gba->cart->rom_size;
+            break;
+        default:
+            return false;
+    }
+
+    int size = thumb ? 2 : 4;
+    int len = ((1 << BLOCK_PAGE_BITS) - (ofs & ((1 << BLOCK_PAGE_BITS) - 1))) /
+              size;
+    word eeprom_mask = gba->cart->eeprom_mask;
+    for (int i = 0; i < len; i++, ofs += size) {
+        if (ofs >= limit ||
+            (limit != -1 && eeprom_mask && (ofs & eeprom_mask) == eeprom_mask)) {
+            len = i;
+            break;
+        }
+        if (thumb) {
+            b->thumb_raw[i] = *(hword*) &mem[ofs];
+            b->instrs[i] = thumb_lookup[b->thumb_raw[i]];
+        } else {
+            b->instrs[i].w = *(word*) &mem[ofs];
+        }
+    }
+    if (len == 0) return false;
+
+    b->start = addr;
+    b->thumb = thumb;
+    b->len = len;
+    b->page = page;
+    b->gen = gba->bcache.gen[page];
+    b->valid = true;
+    return true;
+}
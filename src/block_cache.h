@@ -0,0 +1,90 @@
+#ifndef BLOCK_CACHE_H
+#define BLOCK_CACHE_H
+
+#include "arm_isa.h"
+#include "types.h"
+
+#define BLOCK_CACHE_BITS 10
+#define BLOCK_CACHE_SIZE (1 << BLOCK_CACHE_BITS)
+
+// blocks never cross a page boundary so each block only depends on one page
+#define BLOCK_PAGE_BITS 6
+#define BLOCK_MAX_LEN ((1 << BLOCK_PAGE_BITS) / 2)
+
+// page 0 is shared by all memory that can't be written (bios and rom), the
+// rest track writes to ewram and iwram
+enum {
+    BLOCK_PAGE_RO,
+    BLOCK_PAGE_EWRAM,
+    BLOCK_PAGE_IWRAM = BLOCK_PAGE_EWRAM + (0x40000 >> BLOCK_PAGE_BITS),
+    BLOCK_PAGES = BLOCK_PAGE_IWRAM + (0x8000 >> BLOCK_PAGE_BITS)
+};
+
+// never matches an arm (multiple of 4) or thumb (odd) fetch key
+#define BLOCK_KEY_NONE 2
+
+typedef struct {
+    word start;
+    bool valid;
+    bool thumb;
+    byte len;
+    hword page;
+    word gen;
+
+    ArmInstr instrs[BLOCK_MAX_LEN];
+    hword thumb_raw[BLOCK_MAX_LEN];
+} Block;
+
+typedef struct _GBA GBA;
+
+typedef struct {
+    Block blocks[BLOCK_CACHE_SIZE];
+    word gen[BLOCK_PAGES];
+
+    // block and index of the last cached fetch, next_key is the address
+    // (with bit 0 set for thumb) of the instruction after it
+    int cur;
+    int cur_index;
+    word next_key;
+} BlockCache;
+
+void bcache_reset(BlockCache* bc);
+
+bool bcache_build(GBA* gba, Block* b, word addr, bool thumb);
+
+// finds the cached instruction at addr and sets cur_index to its index in the
+// block, returns NULL if the address is not cacheable
+static inline Block* bcache_lookup(GBA* gba, BlockCache* bc, word addr,
+                                   bool thumb) {
+    word key = addr | thumb;
+    if (key == bc->next_key) {
+        Block* b = &bc->blocks[bc->cur];
+        if (++bc->cur_index < b->len && b->gen == bc->gen[b->page]) {
+            bc->next_key += thumb ? 2 : 4;
+            return b;
+        }
+    }
+    int slot = (key * 0x9e3779b1) >> (32 - BLOCK_CACHE_BITS);
+    Block* b = &bc->blocks[slot];
+    if (!(b->valid && b->start == addr && b->thumb == thumb &&
+          b->gen == bc->gen[b->page])) {
+        if (!bcache_build(gba, b, addr, thumb)) {
+            bc->next_key = BLOCK_KEY_NONE;
+            return NULL;
+        }
+    }
+    bc->cur = slot;
+    bc->cur_index = 0;
+    bc->next_key = key + (thumb ? 2 : 4);
+    return b;
+}
+
+static inline void bcache_write_ewram(BlockCache* bc, word addr) {
+    bc->gen[BLOCK_PAGE_EWRAM + ((addr % 0x40000) >> BLOCK_PAGE_BITS)]++;
+}
+
+static inline void bcache_write_iwram(BlockCache* bc, word addr) {
+    bc->gen[BLOCK_PAGE_IWRAM + ((addr % 0x8000) >> BLOCK_PAGE_BITS)]++;
+}
+
+#endif
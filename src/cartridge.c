@@ -1,8 +1,12 @@
 #include "cartridge.h"
 
+#include <fcntl.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 void eeprom_reverse_bytes(dword* eeprom, int size) {
     for (int i = 0; i < size; i++) {
@@ -14,19 +18,26 @@ void eeprom_reverse_bytes(dword* eeprom, int size) {
     }
 }
 
-Cartridge* create_cartridge(char* filename) {
-    FILE* fp = fopen(filename, "rb");
-    if (!fp) return NULL;
-
-    Cartridge* cart = calloc(1, sizeof *cart);
-
-    fseek(fp, 0, SEEK_END);
-    cart->rom_size = ftell(fp);
-    fseek(fp, 0, SEEK_SET);
-    cart->rom.b = malloc(cart->rom_size + 32);
-    (void) !fread(cart->rom.b, 1, cart->rom_size, fp);
-    fclose(fp);
+// maps the rom read only so every process running it shares the page cache,
+// the 32 bytes of padding past the end are zero pages of their own if the
+// file ends too close to a page boundary
+static bool map_rom(Cartridge* cart, int fd) {
+    size_t page = sysconf(_SC_PAGESIZE);
+    size_t size = (cart->rom_size + 32 + page - 1) & ~(page - 1);
+    byte* p = mmap(NULL, size, PROT_READ, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return false;
+    if (cart->rom_size &&
+        mmap(p, cart->rom_size, PROT_READ, MAP_PRIVATE | MAP_FIXED, fd, 0) ==
+            MAP_FAILED) {
+        munmap(p, size);
+        return false;
+    }
+    cart->rom.b = p;
+    cart->rom_map_size = size;
+    return true;
+}
 
+static void detect_save_type(Cartridge* cart) {
     cart->sav_type = SAV_NONE;
     cart->sav_size = 0;
     cart->eeprom_mask = 0;
@@ -72,6 +83,27 @@ Cartridge* create_cartridge(char* filename) {
             break;
         }
     }
+}
+
+Cartridge* create_cartridge(char* filename) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size > ROM_MAX_SIZE) {
+        close(fd);
+        return NULL;
+    }
+
+    Cartridge* cart = calloc(1, sizeof *cart);
+
+    cart->rom_size = st.st_size;
+    if (!map_rom(cart, fd)) {
+        cart->rom.b = calloc(1, cart->rom_size + 32);
+        (void) !read(fd, cart->rom.b, cart->rom_size);
+    }
+    close(fd);
+
+    detect_save_type(cart);
 
     cart->rom_filename = malloc(strlen(filename) + 1);
     strcpy(cart->rom_filename, filename);
@@ -98,9 +130,39 @@ Cartridge* create_cartridge(char* filename) {
     return cart;
 }
 
+// the rom is copied and the save memory starts out blank and is not written
+// anywhere when the cartridge is destroyed, NULL if the rom does not fit the
+// rom space or there is no memory for it
+Cartridge* create_cartridge_mem(const void* rom, size_t rom_size) {
+    if (rom_size == 0 || rom_size > ROM_MAX_SIZE) return NULL;
+    Cartridge* cart = calloc(1, sizeof *cart);
+    if (!cart) return NULL;
+    cart->rom_size = rom_size;
+    cart->rom.b = calloc(1, rom_size + 32);
+    if (!cart->rom.b) {
+        free(cart);
+        return NULL;
+    }
+    memcpy(cart->rom.b, rom, rom_size);
+
+    detect_save_type(cart);
+
+    if (cart->sav_size) {
+        cart->sram = malloc(cart->sav_size);
+        if (!cart->sram) {
+            cart->sav_size = 0;
+            destroy_cartridge(cart);
+            return NULL;
+        }
+        memset(cart->sram, 0xff, cart->sav_size);
+    }
+
+    return cart;
+}
+
 void destroy_cartridge(Cartridge* cart) {
     if (cart->sav_size) {
-        FILE* fp = fopen(cart->sav_filename, "wb");
+        FILE* fp = cart->sav_filename ? fopen(cart->sav_filename, "wb") : NULL;
         if (fp) {
             if (cart->sav_type == SAV_EEPROM) {
                 eeprom_reverse_bytes(cart->eeprom, cart->sav_size / 8);
@@ -115,7 +177,8 @@ void destroy_cartridge(Cartridge* cart) {
     free(cart->sav_filename);
     free(cart->sst_filename);
 
-    free(cart->rom.b);
+    if (cart->rom_map_size) munmap(cart->rom.b, cart->rom_map_size);
+    else free(cart->rom.b);
     free(cart);
 }
 
@@ -13,7 +13,8 @@ enum {
     SRAM_SIZE = 1 << 15,
     FLASH_BK_SIZE = 1 << 16,
     EEPROM_SIZE_S = 1 << 9,
-    EEPROM_SIZE_L = 1 << 13
+    EEPROM_SIZE_L = 1 << 13,
+    ROM_MAX_SIZE = 1 << 25
 };
 
 typedef struct {
@@ -28,6 +29,9 @@ typedef struct {
         word* w;
     } rom;
     int rom_size;
+    // size of the read only mapping the rom is in, 0 if it was read into
+    // memory instead
+    size_t rom_map_size;
 
     SavType sav_type;
     int sav_size;
@@ -69,6 +73,7 @@ typedef struct {
 } Cartridge;
 
 Cartridge* create_cartridge(char* filename);
+Cartridge* create_cartridge_mem(const void* rom, size_t rom_size);
 void destroy_cartridge(Cartridge* cart);
 
 byte cart_read_sram(Cartridge* cart, hword addr);
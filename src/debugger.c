@@ -100,7 +100,7 @@ void debugger_run() {
                         char ans[5];
                         (void) !fgets(ans, 5, stdin);
                         if (ans[0] == 'y') {
-                            init_gba(agbemu.gba, agbemu.cart, agbemu.bios, agbemu.bootbios);
+                            agbemu_reset(agbemu.emu);
                             return;
                         }
                         break;
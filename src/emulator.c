@@ -1,11 +1,13 @@
 #include "emulator.h"
 
-#include <SDL2/SDL.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <zlib.h>
 
-#include "arm_isa.h"
 #include "gba.h"
-#include "thumb_isa.h"
+#include "savestate.h"
 
 EmulatorState agbemu;
 
@@ -13,7 +15,18 @@ const char usage[] = "agbemu [options] <romfile>\n"
                      "-b <biosfile> -- specify bios file path\n"
                      "-f -- apply color filter\n"
                      "-u -- run at uncapped speed\n"
-                     "-d -- run the debugger\n";
+                     "-d -- run the debugger\n"
+                     "-t -- draw scanlines on a separate thread\n"
+                     "--frameskip <n> -- only draw every n+1th frame\n"
+                     "--no-video -- never draw, for audio only runs\n"
+                     "--rewind <mb> -- keep up to mb megabytes of rewind\n"
+                     "  history, hold backspace to rewind\n"
+                     "--run-ahead <n> -- show the frame n frames ahead to\n"
+                     "  hide input lag\n"
+                     "--record <file> -- record the input from power on to\n"
+                     "  a movie file\n"
+                     "--bench <frames> -- run uncapped without video or audio\n"
+                     "  and print timing info as json\n";
 
 int emulator_init(int argc, char** argv) {
     read_args(argc, argv);
@@ -25,26 +38,38 @@ int emulator_init(int argc, char** argv) {
         agbemu.biosfile = "bios.bin";
     }
 
-    agbemu.gba = malloc(sizeof *agbemu.gba);
-    agbemu.cart = create_cartridge(agbemu.romfile);
-    if (!agbemu.cart) {
-        free(agbemu.gba);
-        printf("Invalid rom file\n");
+    AgbemuConfig cfg = {
+        .boot_bios = agbemu.bootbios,
+        .threaded_render = agbemu.threaded_render,
+    };
+    agbemu.emu = agbemu_open(agbemu.romfile, agbemu.biosfile, &cfg);
+    if (!agbemu.emu) {
+        printf("Invalid rom file or invalid or missing bios file.\n");
         return -1;
     }
+    agbemu.gba = agbemu_gba(agbemu.emu);
 
-    agbemu.bios = load_bios(agbemu.biosfile);
-    if (!agbemu.bios) {
-        free(agbemu.gba);
-        destroy_cartridge(agbemu.cart);
-        printf("Invalid or missing bios file.\n");
-        return -1;
+    init_color_lookups();
+
+    if (cfg.threaded_render && !agbemu.gba->renderer) {
+        printf("Could not start the renderer thread\n");
     }
 
-    arm_generate_lookup();
-    thumb_generate_lookup();
-    init_color_lookups();
-    init_gba(agbemu.gba, agbemu.cart, agbemu.bios, agbemu.bootbios);
+    if (agbemu.rewind_mb > 0 && agbemu.record_file) {
+        printf("Rewind is off while recording a movie\n");
+    } else if (agbemu.rewind_mb > 0) {
+        size_t budget = (size_t) agbemu.rewind_mb << 20;
+        agbemu.rewind = create_rewind(agbemu.gba, budget, REWIND_INTERVAL);
+    }
+
+    if (agbemu.record_file) {
+        agbemu.movie = movie_record(agbemu.gba, false, agbemu.bootbios);
+    }
+
+    if (agbemu.run_ahead > 0) {
+        agbemu.ahead_state_size = gba_serialize(agbemu.gba, NULL, 0);
+        agbemu.ahead_state = malloc(agbemu.ahead_state_size);
+    }
 
     agbemu.romfilenodir = strrchr(agbemu.romfile, '/');
     if (agbemu.romfilenodir) agbemu.romfilenodir++;
@@ -53,14 +78,163 @@ int emulator_init(int argc, char** argv) {
 }
 
 void emulator_quit() {
-    destroy_cartridge(agbemu.cart);
-    free(agbemu.bios);
-    free(agbemu.gba);
+    if (agbemu.movie && !agbemu.movie->playing &&
+        !movie_save(agbemu.movie, agbemu.record_file)) {
+        printf("Could not write %s\n", agbemu.record_file);
+    }
+    destroy_movie(agbemu.movie);
+    destroy_rewind(agbemu.rewind);
+    free(agbemu.ahead_state);
+    agbemu_destroy(agbemu.emu);
+}
+
+// skipped frames still run the ppu timing, irqs and dmas, only the drawing
+// is left out, with run ahead only the frames ahead are ever shown so the
+// real ones are never drawn unless a movie checkpoint needs the screen
+void emulator_frame_start(dword frame) {
+    agbemu_skip_draw(agbemu.emu, agbemu.no_video || agbemu.run_ahead > 0 ||
+                                     frame % (agbemu.frameskip + 1));
+}
+
+// runs a frame and keeps the movie and rewind history up to date, the
+// debugger has to see every instruction to stop on the breakpoint so false is
+// returned if it did
+bool emulator_run_frame(dword frame) {
+    emulator_frame_start(frame);
+    if (agbemu.movie) movie_frame_start(agbemu.movie, agbemu.gba);
+    if (agbemu.debugger) {
+        GBA* gba = agbemu.gba;
+        while (!gba->stop && !gba->ppu.frame_complete) {
+            if (gba->cpu.cur_instr_addr == agbemu.breakpoint) {
+                printf("Breakpoint hit: %#x\n", agbemu.breakpoint);
+                return false;
+            }
+            agbemu_step(agbemu.emu);
+        }
+        gba->ppu.frame_complete = false;
+    } else agbemu_run_frame(agbemu.emu);
+    if (agbemu.movie) movie_frame_end(agbemu.movie, agbemu.gba);
+    if (agbemu.rewind) rewind_frame(agbemu.rewind, agbemu.gba);
+    return true;
+}
+
+// runs the next frames with the current input and copies the last one to
+// screen, then puts the state back so only the picture comes from the future
+void emulator_run_ahead(hword* screen) {
+    Agbemu* emu = agbemu.emu;
+    agbemu_serialize(emu, agbemu.ahead_state, agbemu.ahead_state_size);
+
+    for (int i = 0; i < agbemu.run_ahead; i++) {
+        agbemu_skip_draw(emu, agbemu.no_video || i < agbemu.run_ahead - 1);
+        if (!agbemu_run_frame(emu)) break;
+    }
+    agbemu_drain_audio(emu, NULL, SIZE_MAX);
+
+    memcpy(screen, agbemu_framebuffer(emu),
+           sizeof(hword) * GBA_SCREEN_W * GBA_SCREEN_H);
+    agbemu_deserialize(emu, agbemu.ahead_state, agbemu.ahead_state_size);
+}
+
+void emulator_set_keys(hword pressed) {
+    agbemu_set_keys(agbemu.emu, pressed);
+    if (agbemu.movie) movie_poll(agbemu.movie, agbemu.gba);
+}
+
+void emulator_rewind_step() {
+    rewind_step(agbemu.rewind, agbemu.gba);
+}
+
+static int bench_frames(int frames, dword* instrs) {
+    GBA* gba = agbemu.gba;
+    int frame = 0;
+    emulator_frame_start(frame);
+    while (frame < frames && !gba->stop) {
+        *instrs += agbemu_step(agbemu.emu);
+        agbemu_drain_audio(agbemu.emu, NULL, SIZE_MAX);
+        if (gba->ppu.frame_complete) {
+            gba->ppu.frame_complete = false;
+            frame++;
+            emulator_frame_start(frame);
+        }
+    }
+    return frame;
+}
+
+void emulator_bench() {
+    GBA* gba = agbemu.gba;
+
+    // the profiler adds overhead to every event so the throughput is measured
+    // on a separate run from the time split
+    dword instrs = 0;
+    dword start = prof_clock();
+    int frames = bench_frames(agbemu.bench_frames, &instrs);
+    double secs = (prof_clock() - start) / 1e9;
+    dword cycles = gba->sched.now;
+
+    agbemu_reset(agbemu.emu);
+    Profiler prof;
+    gba->prof = &prof;
+    prof_start(&prof);
+    bench_frames(frames, &(dword){0});
+    prof_stop(&prof);
+    gba->prof = NULL;
+
+    dword total = 0;
+    for (int i = 0; i < PROF_MAX; i++) total += prof.time[i];
+    if (!total) total = 1;
+
+    // what rewind and run ahead pay per snapshot, compared to a frame
+    size_t state_size = gba_serialize(gba, NULL, 0);
+    void* state = malloc(state_size);
+    const int state_reps = 100;
+    dword save_start = prof_clock();
+    for (int i = 0; i < state_reps; i++) {
+        gba_serialize(gba, state, state_size);
+    }
+    dword save_time = prof_clock() - save_start;
+    dword load_start = prof_clock();
+    for (int i = 0; i < state_reps; i++) {
+        gba_deserialize(gba, state, state_size);
+    }
+    dword load_time = prof_clock() - load_start;
+    free(state);
+
+    printf("{\n");
+    printf("  \"frames\": %d,\n", frames);
+    printf("  \"seconds\": %.6f,\n", secs);
+    printf("  \"frames_per_second\": %.2f,\n", frames / secs);
+    printf("  \"cycles\": %lu,\n", cycles);
+    printf("  \"cycles_per_second\": %.0f,\n", cycles / secs);
+    printf("  \"instructions\": %lu,\n", instrs);
+    printf("  \"instructions_per_second\": %.0f,\n", instrs / secs);
+    printf("  \"state_bytes\": %zu,\n", state_size);
+    printf("  \"save_state_us\": %.2f,\n", save_time / 1e3 / state_reps);
+    printf("  \"load_state_us\": %.2f,\n", load_time / 1e3 / state_reps);
+    printf("  \"frame_us\": %.2f,\n", secs * 1e6 / (frames ? frames : 1));
+    printf("  \"time_split\": {\n");
+    for (int i = 0; i < PROF_MAX; i++) {
+        printf("    \"%s\": %.4f%s\n", prof_section_names[i],
+               (double) prof.time[i] / total, i + 1 < PROF_MAX ? "," : "");
+    }
+    printf("  }\n");
+    printf("}\n");
 }
 
 void read_args(int argc, char** argv) {
     for (int i = 1; i < argc; i++) {
-        if (argv[i][0] == '-') {
+        if (!strcmp(argv[i], "--bench")) {
+            if (i + 1 < argc) agbemu.bench_frames = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--frameskip")) {
+            if (i + 1 < argc) agbemu.frameskip = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--no-video")) {
+            agbemu.no_video = true;
+        } else if (!strcmp(argv[i], "--rewind")) {
+            if (i + 1 < argc) agbemu.rewind_mb = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--run-ahead")) {
+            if (i + 1 < argc) agbemu.run_ahead = atoi(argv[++i]);
+        } else if (!strcmp(argv[i], "--record")) {
+            if (i + 1 < argc) agbemu.record_file = argv[++i];
+        } else if (argv[i][0] == '-') {
             for (char* f = &argv[i][1]; *f; f++) {
                 switch (*f) {
                     case 'u':
@@ -78,6 +252,9 @@ void read_args(int argc, char** argv) {
                     case 'd':
                         agbemu.debugger = true;
                         break;
+                    case 't':
+                        agbemu.threaded_render = true;
+                        break;
                     default:
                         printf("Invalid flag\n");
                 }
@@ -89,116 +266,105 @@ void read_args(int argc, char** argv) {
 }
 
 void save_state() {
-    gba_clear_ptrs(agbemu.gba);
+    size_t size = gba_serialize(agbemu.gba, NULL, 0);
+    void* buf = malloc(size);
+    gba_serialize(agbemu.gba, buf, size);
 
-    gzFile fp = gzopen(agbemu.cart->sst_filename, "wb");
-    gzfwrite(agbemu.gba, sizeof *agbemu.gba, 1, fp);
-    gzfwrite(&agbemu.cart->st, sizeof agbemu.cart->st, 1, fp);
-    gzclose(fp);
-
-    gba_set_ptrs(agbemu.gba, agbemu.cart, agbemu.bios);
+    gzFile fp = gzopen(agbemu.gba->cart->sst_filename, "wb");
+    if (fp) {
+        gzfwrite(buf, size, 1, fp);
+        gzclose(fp);
+    } else printf("Could not open %s\n", agbemu.gba->cart->sst_filename);
+    free(buf);
 }
 
 void load_state() {
-    gba_clear_ptrs(agbemu.gba);
-
-    gzFile fp = gzopen(agbemu.cart->sst_filename, "rb");
-    gzfread(agbemu.gba, sizeof *agbemu.gba, 1, fp);
-    gzfread(&agbemu.cart->st, sizeof agbemu.cart->st, 1, fp);
+    gzFile fp = gzopen(agbemu.gba->cart->sst_filename, "rb");
+    if (!fp) {
+        printf("Could not open %s\n", agbemu.gba->cart->sst_filename);
+        return;
+    }
+    size_t size = gba_serialize(agbemu.gba, NULL, 0);
+    void* buf = malloc(size);
+    size_t len = gzfread(buf, 1, size, fp);
     gzclose(fp);
 
-    gba_set_ptrs(agbemu.gba, agbemu.cart, agbemu.bios);
-}
-
-void hotkey_press(SDL_KeyCode key) {
-    switch (key) {
-        case SDLK_p:
-            agbemu.pause = !agbemu.pause;
-            break;
-        case SDLK_m:
-            agbemu.mute = !agbemu.mute;
-            break;
-        case SDLK_f:
-            agbemu.filter = !agbemu.filter;
-            break;
-        case SDLK_r:
-            init_gba(agbemu.gba, agbemu.cart, agbemu.bios, agbemu.bootbios);
-            agbemu.pause = false;
-            break;
-        case SDLK_TAB:
-            agbemu.uncap = !agbemu.uncap;
-            break;
-        case SDLK_9:
-            save_state();
-            break;
-        case SDLK_0:
-            load_state();
-            break;
-        default:
-            break;
-    }
-}
-
-void update_input_keyboard(GBA* gba) {
-    const Uint8* keys = SDL_GetKeyboardState(NULL);
-    gba->io.keyinput.a = ~keys[SDL_SCANCODE_Z];
-    gba->io.keyinput.b = ~keys[SDL_SCANCODE_X];
-    gba->io.keyinput.start = ~keys[SDL_SCANCODE_RETURN];
-    gba->io.keyinput.select = ~keys[SDL_SCANCODE_RSHIFT];
-    gba->io.keyinput.left = ~keys[SDL_SCANCODE_LEFT];
-    gba->io.keyinput.right = ~keys[SDL_SCANCODE_RIGHT];
-    gba->io.keyinput.up = ~keys[SDL_SCANCODE_UP];
-    gba->io.keyinput.down = ~keys[SDL_SCANCODE_DOWN];
-    gba->io.keyinput.l = ~keys[SDL_SCANCODE_A];
-    gba->io.keyinput.r = ~keys[SDL_SCANCODE_S];
-}
-
-void update_input_controller(GBA* gba, SDL_GameController* controller) {
-    gba->io.keyinput.a &=
-        ~SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_A);
-    gba->io.keyinput.b &=
-        ~SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_X);
-    gba->io.keyinput.start &=
-        ~SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_START);
-    gba->io.keyinput.select &=
-        ~SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_BACK);
-    gba->io.keyinput.left &= ~SDL_GameControllerGetButton(
-        controller, SDL_CONTROLLER_BUTTON_DPAD_LEFT);
-    gba->io.keyinput.right &= ~SDL_GameControllerGetButton(
-        controller, SDL_CONTROLLER_BUTTON_DPAD_RIGHT);
-    gba->io.keyinput.up &=
-        ~SDL_GameControllerGetButton(controller, SDL_CONTROLLER_BUTTON_DPAD_UP);
-    gba->io.keyinput.down &= ~SDL_GameControllerGetButton(
-        controller, SDL_CONTROLLER_BUTTON_DPAD_DOWN);
-    gba->io.keyinput.l &= ~SDL_GameControllerGetButton(
-        controller, SDL_CONTROLLER_BUTTON_LEFTSHOULDER);
-    gba->io.keyinput.r &= ~SDL_GameControllerGetButton(
-        controller, SDL_CONTROLLER_BUTTON_RIGHTSHOULDER);
+    if (!gba_deserialize(agbemu.gba, buf, len)) {
+        printf("Save state is invalid or from a different version\n");
+    }
+    free(buf);
 }
 
 byte color_lookup[32];
 byte color_lookup_filter[32];
 
+// every bgr555 color in the current output format, rebuilt when the format or
+// the filter changes
+static word color_lut[0x8000];
+static PixelFormat color_lut_fmt;
+static bool color_lut_filter;
+static bool color_lut_valid;
+
 void init_color_lookups() {
     for (int i = 0; i < 32; i++) {
         float c = (float) i / 31;
         color_lookup[i] = c * 255;
         color_lookup_filter[i] = pow(c, 1.7) * 255;
     }
+    color_lut_valid = false;
 }
 
-void gba_convert_screen(hword* gba_screen, Uint32* screen) {
-    for (int i = 0; i < GBA_SCREEN_W * GBA_SCREEN_H; i++) {
-        int r = gba_screen[i] & 0x1f;
-        int g = (gba_screen[i] >> 5) & 0x1f;
-        int b = (gba_screen[i] >> 10) & 0x1f;
-        if (agbemu.filter) {
-            screen[i] = color_lookup_filter[r] << 16 |
-                        color_lookup_filter[g] << 8 |
-                        color_lookup_filter[b] << 0;
-        } else {
-            screen[i] = color_lookup[r] << 16 | color_lookup[g] << 8 |
-                        color_lookup[b] << 0;
+int pixel_format_size(PixelFormat fmt) {
+    return fmt == PIXFMT_RGB565 || fmt == PIXFMT_BGR555 ? 2 : 4;
+}
+
+static void build_color_lut(PixelFormat fmt) {
+    byte* lookup = agbemu.filter ? color_lookup_filter : color_lookup;
+    for (int i = 0; i < 0x8000; i++) {
+        byte r = lookup[i & 0x1f];
+        byte g = lookup[(i >> 5) & 0x1f];
+        byte b = lookup[(i >> 10) & 0x1f];
+        switch (fmt) {
+            case PIXFMT_ARGB8888:
+                color_lut[i] = 0xff << 24 | r << 16 | g << 8 | b;
+                break;
+            case PIXFMT_RGBA8888:
+                color_lut[i] = r << 24 | g << 16 | b << 8 | 0xff;
+                break;
+            case PIXFMT_RGB565:
+                color_lut[i] = (r >> 3) << 11 | (g >> 2) << 5 | b >> 3;
+                break;
+            case PIXFMT_BGR555:
+                color_lut[i] = i;
+                break;
+        }
+    }
+    color_lut_fmt = fmt;
+    color_lut_filter = agbemu.filter;
+    color_lut_valid = true;
+}
+
+void gba_convert_screen(hword* gba_screen, void* screen, PixelFormat fmt) {
+    if (fmt == PIXFMT_BGR555) {
+        hword* dst = screen;
+        for (int i = 0; i < GBA_SCREEN_W * GBA_SCREEN_H; i++) {
+            dst[i] = gba_screen[i] & 0x7fff;
         }
+        return;
     }
-}
\ No newline at end of file
+    if (!color_lut_valid || color_lut_fmt != fmt ||
+        color_lut_filter != agbemu.filter) {
+        build_color_lut(fmt);
+    }
+    if (pixel_format_size(fmt) == 2) {
+        hword* dst = screen;
+        for (int i = 0; i < GBA_SCREEN_W * GBA_SCREEN_H; i++) {
+            dst[i] = color_lut[gba_screen[i] & 0x7fff];
+        }
+    } else {
+        word* dst = screen;
+        for (int i = 0; i < GBA_SCREEN_W * GBA_SCREEN_H; i++) {
+            dst[i] = color_lut[gba_screen[i] & 0x7fff];
+        }
+    }
+}
@@ -1,11 +1,20 @@
 #ifndef EMULATOR_H
 #define EMULATOR_H
 
-#include <SDL2/SDL.h>
-
 #include "gba.h"
+#include "libagbemu.h"
+#include "movie.h"
+#include "renderer.h"
+#include "rewind.h"
 #include "types.h"
 
+typedef enum {
+    PIXFMT_ARGB8888,
+    PIXFMT_RGBA8888,
+    PIXFMT_RGB565,
+    PIXFMT_BGR555
+} PixelFormat;
+
 typedef struct {
     bool running;
     char* romfile;
@@ -17,10 +26,22 @@ typedef struct {
     bool pause;
     bool mute;
     bool debugger;
+    bool threaded_render;
+    int bench_frames;
+    int frameskip;
+    bool no_video;
+    int rewind_mb;
+    int run_ahead;
+    char* record_file;
 
+    // the frontend runs the emulator through the library, gba is only for the
+    // debugger and for handing to the movie, rewind and profiler code
+    Agbemu* emu;
     GBA* gba;
-    Cartridge* cart;
-    byte* bios;
+    Rewind* rewind;
+    void* ahead_state;
+    size_t ahead_state_size;
+    Movie* movie;
 
     word breakpoint;
 
@@ -30,12 +51,19 @@ extern EmulatorState agbemu;
 
 int emulator_init(int argc, char** argv);
 void emulator_quit();
+void emulator_bench();
+
+void emulator_frame_start(dword frame);
+bool emulator_run_frame(dword frame);
+void emulator_run_ahead(hword* screen);
+void emulator_set_keys(hword pressed);
+void emulator_rewind_step();
 
 void read_args(int argc, char** argv);
-void hotkey_press(SDL_KeyCode key);
-void update_input_keyboard(GBA* gba);
-void update_input_controller(GBA* gba, SDL_GameController* controller);
+void save_state();
+void load_state();
 void init_color_lookups();
-void gba_convert_screen(hword* gba_screen, Uint32* screen);
+int pixel_format_size(PixelFormat fmt);
+void gba_convert_screen(hword* gba_screen, void* screen, PixelFormat fmt);
 
 #endif
\ No newline at end of file
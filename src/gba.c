@@ -15,8 +15,68 @@
 
 const int CART_WAITS[4] = {5, 4, 3, 9};
 
+static void event_tm_reload(void* tmc, int i) {
+    APU* apu = &((TimerController*) tmc)->master->apu;
+    apu_timer_event_start(apu, i);
+    reload_timer(tmc, i);
+    apu_timer_event_end(apu);
+}
+
+static void event_tm_enable(void* tmc, int i) {
+    enable_timer(tmc, i);
+}
+
+static void event_tm_irq(void* io, int i) {
+    ((IO*) io)->ifl.timer |= 1 << i;
+}
+
+static void event_tm_write_l(void* io, int i) {
+    timer_write_l(io, i);
+}
+
+static void event_tm_write_h(void* io, int i) {
+    timer_write_h(io, i);
+}
+
+static void event_dma(void* dmac, int i) {
+    dma_run(dmac, i);
+}
+
+static void event_ppu_hdraw(void* ppu, int i) {
+    ppu_hdraw(ppu);
+}
+
+static void event_ppu_hblank(void* ppu, int i) {
+    ppu_hblank(ppu);
+}
+
+static void event_apu_flush(void* apu, int i) {
+    apu_flush(apu);
+}
+
+void gba_set_event_handlers(GBA* gba) {
+    Scheduler* sched = &gba->sched;
+    for (int i = 0; i < 4; i++) {
+        set_event_handler(sched, EVENT_TM0_REL + i, event_tm_reload, &gba->tmc,
+                          i);
+        set_event_handler(sched, EVENT_TM0_ENA + i, event_tm_enable, &gba->tmc,
+                          i);
+        set_event_handler(sched, EVENT_TM0_IRQ + i, event_tm_irq, &gba->io, i);
+        set_event_handler(sched, EVENT_TM0_WRITE_L + i, event_tm_write_l,
+                          &gba->io, i);
+        set_event_handler(sched, EVENT_TM0_WRITE_H + i, event_tm_write_h,
+                          &gba->io, i);
+        set_event_handler(sched, EVENT_DMA0 + i, event_dma, &gba->dmac, i);
+    }
+    set_event_handler(sched, EVENT_PPU_HDRAW, event_ppu_hdraw, &gba->ppu, 0);
+    set_event_handler(sched, EVENT_PPU_HBLANK, event_ppu_hblank, &gba->ppu, 0);
+    set_event_handler(sched, EVENT_APU_FLUSH, event_apu_flush, &gba->apu, 0);
+}
+
 void gba_clear_ptrs(GBA* gba) {
     gba->cart = NULL;
+    gba->prof = NULL;
+    gba->renderer = NULL;
     gba->cpu.master = NULL;
     gba->ppu.master = NULL;
     gba->apu.master = NULL;
@@ -24,7 +84,9 @@ void gba_clear_ptrs(GBA* gba) {
     gba->tmc.master = NULL;
     gba->io.master = NULL;
     gba->sched.master = gba;
+    memset(gba->sched.handlers, 0, sizeof gba->sched.handlers);
     gba->bios.b = NULL;
+    memset(gba->pages, 0, sizeof gba->pages);
 }
 
 void gba_set_ptrs(GBA* gba, Cartridge* cart, byte* bios) {
@@ -36,7 +98,11 @@ void gba_set_ptrs(GBA* gba, Cartridge* cart, byte* bios) {
     gba->tmc.master = gba;
     gba->io.master = gba;
     gba->sched.master = gba;
+    gba_set_event_handlers(gba);
     gba->bios.b = bios;
+    update_mem_pages(gba);
+    bcache_reset(&gba->bcache);
+    tcache_reset(&gba->tcache);
 }
 
 void init_gba(GBA* gba, Cartridge* cart, byte* bios, bool bootbios) {
@@ -46,6 +112,8 @@ void init_gba(GBA* gba, Cartridge* cart, byte* bios, bool bootbios) {
     gba_set_ptrs(gba, cart, bios);
 
     gba->dmac.active_dma = 4;
+    gba->ppu.objlist_dirty = true;
+    gba->ppu.screen_changed = true;
 
     update_cart_waits(gba);
 
@@ -84,6 +152,64 @@ byte* load_bios(char* filename) {
     return bios;
 }
 
+void update_mem_pages(GBA* gba) {
+    memset(gba->pages, 0, sizeof gba->pages);
+    for (int i = 0; i < MEM_PAGES; i++) {
+        MemPage* p = &gba->pages[i];
+        word addr = i << MEM_PAGE_BITS;
+        word ofs;
+        p->mask = MEM_PAGE_SIZE - 1;
+        p->writable = true;
+        switch (addr >> 24) {
+            case R_EWRAM:
+                ofs = addr % EWRAM_SIZE;
+                p->ptr = &gba->ewram.b[ofs];
+                p->code_page = BLOCK_PAGE_EWRAM + (ofs >> BLOCK_PAGE_BITS);
+                break;
+            case R_IWRAM:
+                ofs = addr % IWRAM_SIZE;
+                p->ptr = &gba->iwram.b[ofs];
+                p->code_page = BLOCK_PAGE_IWRAM + (ofs >> BLOCK_PAGE_BITS);
+                break;
+            case R_PRAM:
+                p->ptr = gba->pram.b;
+                p->mask = PRAM_SIZE - 1;
+                p->video = R_PRAM;
+                break;
+            case R_VRAM:
+                // the mirror of the upper 32kb uses the slow path
+                ofs = addr % 0x20000;
+                if (ofs < VRAM_SIZE) p->ptr = &gba->vram.b[ofs];
+                p->video = R_VRAM;
+                break;
+            case R_OAM:
+                p->ptr = gba->oam.b;
+                p->mask = OAM_SIZE - 1;
+                p->video = R_OAM;
+                break;
+            case R_ROM0:
+            case R_ROM0EX:
+            case R_ROM1:
+            case R_ROM1EX:
+            case R_ROM2:
+            case R_ROM2EX: {
+                // pages past the end of the rom or containing the eeprom
+                // use the slow path
+                ofs = addr % (1 << 25);
+                word last = ofs + MEM_PAGE_SIZE - 1;
+                word eeprom_mask = gba->cart->eeprom_mask;
+                if (last < gba->cart->rom_size &&
+                    !(eeprom_mask && (last & eeprom_mask) == eeprom_mask)) {
+                    p->ptr = &gba->cart->rom.b[ofs];
+                    p->writable = false;
+                }
+                break;
+            }
+        }
+        if (!p->ptr) p->writable = false;
+    }
+}
+
 void update_cart_waits(GBA* gba) {
     gba->cart_n_waits[0] = CART_WAITS[gba->io.waitcnt.rom0];
     gba->cart_n_waits[1] = CART_WAITS[gba->io.waitcnt.rom1];
@@ -92,24 +218,37 @@ void update_cart_waits(GBA* gba) {
     gba->cart_s_waits[0] = gba->io.waitcnt.rom0s ? 2 : 3;
     gba->cart_s_waits[1] = gba->io.waitcnt.rom1s ? 2 : 5;
     gba->cart_s_waits[2] = gba->io.waitcnt.rom2s ? 2 : 9;
+
+    for (int w = 0; w < 2; w++) {
+        for (int seq = 0; seq < 2; seq++) {
+            for (int region = 0; region < 256; region++) {
+                int waits = 1;
+                if (region < 8) {
+                    if (region == R_EWRAM) waits = 3;
+                    if (w && (region == R_EWRAM || region == R_PRAM ||
+                              region == R_VRAM)) {
+                        waits += waits;
+                    }
+                } else if (region < 16) {
+                    int i = (region >> 1) & 0b11;
+                    if (i == 3) {
+                        waits = gba->cart_n_waits[3];
+                    } else {
+                        waits = seq ? gba->cart_s_waits[i]
+                                    : gba->cart_n_waits[i];
+                        if (w) waits += gba->cart_s_waits[i];
+                    }
+                }
+                gba->waitstates[w][seq][region] = waits;
+            }
+        }
+    }
 }
 
 int get_waitstates(GBA* gba, word addr, bool w, bool seq) {
     word region = addr >> 24;
-    if (region < 8) {
-        int waits = 1;
-        if (region == R_EWRAM) waits = 3;
-        if (w && (region == R_EWRAM || region == R_PRAM || region == R_VRAM)) {
-            waits += waits;
-        }
-        if (!gba->prefetch_halted) gba->prefetcher_cycles += waits;
-        return waits;
-    } else if (region < 16) {
-        int i = (region >> 1) & 0b11;
-        if (i == 3) return gba->cart_n_waits[3];
-
-        int n_waits = gba->cart_n_waits[i];
-        int s_waits = gba->cart_s_waits[i];
+    if (region >= R_ROM0 && region < R_SRAM) {
+        int s_waits = gba->cart_s_waits[(region >> 1) & 0b11];
         int total = 0;
 
         if (gba->io.waitcnt.prefetch &&
@@ -121,38 +260,19 @@ int get_waitstates(GBA* gba, word addr, bool w, bool seq) {
 
         if (addr % 0x20000 == 0) seq = false;
 
-        if (seq) {
-            total += s_waits;
-        } else {
-            total += n_waits;
-        }
-        if (w) {
-            total += s_waits;
-        }
-        return total;
-    } else {
-        return 1;
+        return total + gba->waitstates[w][seq][region];
     }
+    int waits = gba->waitstates[w][seq][region];
+    if (region < 8 && !gba->prefetch_halted) gba->prefetcher_cycles += waits;
+    return waits;
 }
 
 int get_fetch_waitstates(GBA* gba, word addr, bool w, bool seq) {
     if (!gba->io.waitcnt.prefetch) return get_waitstates(gba, addr, w, seq);
     word region = addr >> 24;
-    word rom_addr = addr % (1 << 25);
-    if (region < 8) {
-        int waits = 1;
-        if (region == R_EWRAM) waits = 3;
-        if (w && (region == R_EWRAM || region == R_PRAM || region == R_VRAM)) {
-            waits += waits;
-        }
-        gba->prefetcher_cycles += waits;
-        return waits;
-    } else if (region < 16) {
-        int i = (region >> 1) & 0b11;
-        if (i == 3) return gba->cart_n_waits[3];
-
-        int n_waits = gba->cart_n_waits[i];
-        int s_waits = gba->cart_s_waits[i];
+    if (region >= R_ROM0 && region < R_SRAM) {
+        word rom_addr = addr % (1 << 25);
+        int s_waits = gba->cart_s_waits[(region >> 1) & 0b11];
         int total = 0;
         if (rom_addr == gba->next_prefetch_addr) {
             if (w && gba->prefetcher_cycles >= 2 * s_waits - 1) {
@@ -177,23 +297,22 @@ int get_fetch_waitstates(GBA* gba, word addr, bool w, bool seq) {
         } else {
             gba->prefetcher_cycles = 0;
 
-            total += n_waits;
+            total += gba->waitstates[w][0][region];
             gba->next_prefetch_addr = rom_addr + 2;
-            if (w) {
-                total += s_waits;
-                gba->next_prefetch_addr += 2;
-            }
+            if (w) gba->next_prefetch_addr += 2;
         }
         return total;
-    } else return 1;
+    }
+    int waits = gba->waitstates[w][seq][region];
+    if (region < 8) gba->prefetcher_cycles += waits;
+    return waits;
 }
 
 static inline hword read_rom_oob(word addr) {
     return (addr >> 1) & 0xffff;
 }
 
-byte bus_readb(GBA* gba, word addr) {
-    gba->openbus = false;
+static byte bus_readb_slow(GBA* gba, word addr) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -251,8 +370,7 @@ byte bus_readb(GBA* gba, word addr) {
     return 0;
 }
 
-hword bus_readh(GBA* gba, word addr) {
-    gba->openbus = false;
+static hword bus_readh_slow(GBA* gba, word addr) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -310,8 +428,7 @@ hword bus_readh(GBA* gba, word addr) {
     return 0;
 }
 
-word bus_readw(GBA* gba, word addr) {
-    gba->openbus = false;
+static word bus_readw_slow(GBA* gba, word addr) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -374,7 +491,7 @@ word bus_readw(GBA* gba, word addr) {
     return 0;
 }
 
-void bus_writeb(GBA* gba, word addr, byte b) {
+static void bus_writeb_slow(GBA* gba, word addr, byte b) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -383,9 +500,11 @@ void bus_writeb(GBA* gba, word addr, byte b) {
             break;
         case R_EWRAM:
             gba->ewram.b[addr % EWRAM_SIZE] = b;
+            bcache_write_ewram(&gba->bcache, addr);
             break;
         case R_IWRAM:
             gba->iwram.b[addr % IWRAM_SIZE] = b;
+            bcache_write_iwram(&gba->bcache, addr);
             break;
         case R_IO:
             if (addr < IO_SIZE) {
@@ -394,13 +513,17 @@ void bus_writeb(GBA* gba, word addr, byte b) {
             break;
         case R_PRAM:
             gba->pram.h[addr % PRAM_SIZE >> 1] = b * 0x0101;
+            ppu_write_pram(&gba->ppu, addr % PRAM_SIZE);
             break;
         case R_VRAM:
             addr %= 0x20000;
             if (addr >= VRAM_SIZE) addr -= 0x8000;
             if (addr < 0x10000 ||
-                (addr < 0x14000 && gba->io.dispcnt.bg_mode >= 3))
+                (addr < 0x14000 && gba->io.dispcnt.bg_mode >= 3)) {
                 gba->vram.h[addr >> 1] = b * 0x0101;
+                ppu_write_vram(&gba->ppu, addr);
+                tcache_write_vram(&gba->tcache, addr);
+            }
             break;
         case R_OAM:
             break;
@@ -424,7 +547,7 @@ void bus_writeb(GBA* gba, word addr, byte b) {
     }
 }
 
-void bus_writeh(GBA* gba, word addr, hword h) {
+static void bus_writeh_slow(GBA* gba, word addr, hword h) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -433,9 +556,11 @@ void bus_writeh(GBA* gba, word addr, hword h) {
             break;
         case R_EWRAM:
             gba->ewram.h[addr % EWRAM_SIZE >> 1] = h;
+            bcache_write_ewram(&gba->bcache, addr);
             break;
         case R_IWRAM:
             gba->iwram.h[addr % IWRAM_SIZE >> 1] = h;
+            bcache_write_iwram(&gba->bcache, addr);
             break;
         case R_IO:
             if (addr < IO_SIZE) {
@@ -444,14 +569,18 @@ void bus_writeh(GBA* gba, word addr, hword h) {
             break;
         case R_PRAM:
             gba->pram.h[addr % PRAM_SIZE >> 1] = h;
+            ppu_write_pram(&gba->ppu, addr % PRAM_SIZE);
             break;
         case R_VRAM:
             addr %= 0x20000;
             if (addr >= VRAM_SIZE) addr -= 0x8000;
             gba->vram.h[addr >> 1] = h;
+            ppu_write_vram(&gba->ppu, addr);
+            tcache_write_vram(&gba->tcache, addr);
             break;
         case R_OAM:
             gba->oam.h[addr % OAM_SIZE >> 1] = h;
+            ppu_write_oam(&gba->ppu, addr % OAM_SIZE);
             break;
         case R_ROM0:
         case R_ROM0EX:
@@ -473,7 +602,7 @@ void bus_writeh(GBA* gba, word addr, hword h) {
     }
 }
 
-void bus_writew(GBA* gba, word addr, word w) {
+static void bus_writew_slow(GBA* gba, word addr, word w) {
     word region = addr >> 24;
     word rom_addr = addr % (1 << 25);
     addr %= 1 << 24;
@@ -482,9 +611,11 @@ void bus_writew(GBA* gba, word addr, word w) {
             break;
         case R_EWRAM:
             gba->ewram.w[addr % EWRAM_SIZE >> 2] = w;
+            bcache_write_ewram(&gba->bcache, addr);
             break;
         case R_IWRAM:
             gba->iwram.w[addr % IWRAM_SIZE >> 2] = w;
+            bcache_write_iwram(&gba->bcache, addr);
             break;
         case R_IO:
             if (addr < IO_SIZE) {
@@ -493,14 +624,18 @@ void bus_writew(GBA* gba, word addr, word w) {
             break;
         case R_PRAM:
             gba->pram.w[addr % PRAM_SIZE >> 2] = w;
+            ppu_write_pram(&gba->ppu, addr % PRAM_SIZE);
             break;
         case R_VRAM:
             addr %= 0x20000;
             if (addr >= VRAM_SIZE) addr -= 0x8000;
             gba->vram.w[addr >> 2] = w;
+            ppu_write_vram(&gba->ppu, addr);
+            tcache_write_vram(&gba->tcache, addr);
             break;
         case R_OAM:
             gba->oam.w[addr % OAM_SIZE >> 2] = w;
+            ppu_write_oam(&gba->ppu, addr % OAM_SIZE);
             break;
         case R_ROM0:
         case R_ROM0EX:
@@ -523,12 +658,102 @@ void bus_writew(GBA* gba, word addr, word w) {
     }
 }
 
+byte bus_readb(GBA* gba, word addr) {
+    gba->openbus = false;
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->ptr) return p->ptr[addr & p->mask];
+    }
+    return bus_readb_slow(gba, addr);
+}
+
+hword bus_readh(GBA* gba, word addr) {
+    gba->openbus = false;
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->ptr) return *(hword*) &p->ptr[addr & p->mask & ~1];
+    }
+    return bus_readh_slow(gba, addr);
+}
+
+word bus_readw(GBA* gba, word addr) {
+    gba->openbus = false;
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->ptr) return *(word*) &p->ptr[addr & p->mask & ~0b11];
+    }
+    return bus_readw_slow(gba, addr);
+}
+
+// byte writes to pram, vram and oam are special so only ewram and iwram
+// (the pages with code) take the fast path, video writes are only marked if
+// they change the value
+static inline void mark_video_write(GBA* gba, MemPage* p, word ofs) {
+    switch (p->video) {
+        case R_PRAM:
+            ppu_write_pram(&gba->ppu, ofs);
+            break;
+        case R_VRAM:
+            ofs += p->ptr - gba->vram.b;
+            ppu_write_vram(&gba->ppu, ofs);
+            tcache_write_vram(&gba->tcache, ofs);
+            break;
+        case R_OAM:
+            ppu_write_oam(&gba->ppu, ofs);
+            break;
+    }
+}
+
+void bus_writeb(GBA* gba, word addr, byte b) {
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->code_page) {
+            word ofs = addr & p->mask;
+            p->ptr[ofs] = b;
+            gba->bcache.gen[p->code_page + (ofs >> BLOCK_PAGE_BITS)]++;
+            return;
+        }
+    }
+    bus_writeb_slow(gba, addr, b);
+}
+
+void bus_writeh(GBA* gba, word addr, hword h) {
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->writable) {
+            word ofs = addr & p->mask & ~1;
+            if (p->code_page)
+                gba->bcache.gen[p->code_page + (ofs >> BLOCK_PAGE_BITS)]++;
+            else if (p->video && *(hword*) &p->ptr[ofs] != h)
+                mark_video_write(gba, p, ofs);
+            *(hword*) &p->ptr[ofs] = h;
+            return;
+        }
+    }
+    bus_writeh_slow(gba, addr, h);
+}
+
+void bus_writew(GBA* gba, word addr, word w) {
+    if (addr < 1 << 28) {
+        MemPage* p = &gba->pages[addr >> MEM_PAGE_BITS];
+        if (p->writable) {
+            word ofs = addr & p->mask & ~0b11;
+            if (p->code_page)
+                gba->bcache.gen[p->code_page + (ofs >> BLOCK_PAGE_BITS)]++;
+            else if (p->video && *(word*) &p->ptr[ofs] != w)
+                mark_video_write(gba, p, ofs);
+            *(word*) &p->ptr[ofs] = w;
+            return;
+        }
+    }
+    bus_writew_slow(gba, addr, w);
+}
+
 void bus_lock(GBA* gba) {
     gba->bus_locks++;
 }
 
-void bus_unlock(GBA* gba, int dma_prio) {
-    gba->bus_locks = 0;
+void bus_run_waiting_dma(GBA* gba, int dma_prio) {
     for (int i = 0; i < 4 && i < dma_prio; i++) {
         if (gba->dmac.dma[i].waiting) {
             gba->dmac.dma[i].waiting = false;
@@ -537,7 +762,11 @@ void bus_unlock(GBA* gba, int dma_prio) {
                 tick_components(gba, 1, false);
                 gba->prefetcher_cycles += 1;
             }
-            dma_run(&gba->dmac, i);
+            if (gba->prof) {
+                ProfSection prev = prof_switch(gba->prof, PROF_DMA);
+                dma_run(&gba->dmac, i);
+                prof_switch(gba->prof, prev);
+            } else dma_run(&gba->dmac, i);
             if (dma_prio == 5) {
                 tick_components(gba, 1, false);
                 gba->prefetcher_cycles += 1;
@@ -547,31 +776,24 @@ void bus_unlock(GBA* gba, int dma_prio) {
     }
 }
 
-void tick_components(GBA* gba, int cycles, bool mem) {
-    if (mem) {
-        run_scheduler_mem(&gba->sched, cycles);
-    } else {
-        run_scheduler_internal(&gba->sched, cycles);
-    }
-}
-
-void gba_step(GBA* gba) {
-    if (gba->stop) return;
+int gba_step(GBA* gba) {
+    if (gba->stop) return 0;
 
     if (gba->io.ie.h & gba->io.ifl.h) {
         if (gba->halt || ((gba->io.ime & 1) && !gba->cpu.cpsr.i)) {
             gba->halt = false;
             cpu_handle_interrupt(&gba->cpu, I_IRQ);
-            return;
+            return 0;
         }
     }
     if (!gba->halt) {
         cpu_step(&gba->cpu);
-        return;
+        return 1;
     }
     while (!(gba->ppu.frame_complete || gba->apu.samples_full ||
              (gba->io.ie.h & gba->io.ifl.h)))
         run_next_event(&gba->sched);
+    return 0;
 }
 
 void update_keypad_irq(GBA* gba) {
@@ -3,11 +3,15 @@
 
 #include "apu.h"
 #include "arm7tdmi.h"
+#include "block_cache.h"
 #include "cartridge.h"
 #include "dma.h"
 #include "io.h"
 #include "ppu.h"
+#include "profiler.h"
+#include "renderer.h"
 #include "scheduler.h"
+#include "tile_cache.h"
 #include "timer.h"
 #include "types.h"
 
@@ -39,6 +43,22 @@ enum {
     R_SRAMEX
 };
 
+#define MEM_PAGE_BITS 14
+#define MEM_PAGE_SIZE (1 << MEM_PAGE_BITS)
+#define MEM_PAGES (1 << (28 - MEM_PAGE_BITS))
+
+// host memory backing a page of the address space below 0x10000000 with mask
+// applied for mirroring, pages without a pointer go through the slow path
+typedef struct {
+    byte* ptr;
+    word mask;
+    bool writable;
+    // block cache page of the start of the page if writes can modify code
+    hword code_page;
+    // region of video memory the renderer thread needs to know about writes to
+    byte video;
+} MemPage;
+
 typedef struct _GBA {
     Arm7TDMI cpu;
     PPU ppu;
@@ -51,8 +71,14 @@ typedef struct _GBA {
 
     Cartridge* cart;
 
+    // only set while benchmarking
+    Profiler* prof;
+    Renderer* renderer;
+
     int cart_n_waits[4];
     int cart_s_waits[3];
+    // access cycles indexed by 32 bit, sequential and region
+    byte waitstates[2][2][256];
     word next_prefetch_addr;
     int prefetcher_cycles;
     bool prefetch_halted;
@@ -103,8 +129,15 @@ typedef struct _GBA {
     int bus_locks;
     bool openbus;
 
+    MemPage pages[MEM_PAGES];
+
+    BlockCache bcache;
+    TileCache tcache;
+
 } GBA;
 
+void gba_set_event_handlers(GBA* gba);
+
 void gba_clear_ptrs(GBA* gba);
 void gba_set_ptrs(GBA* gba, Cartridge* cart, byte* bios);
 
@@ -112,11 +145,23 @@ void init_gba(GBA* gba, Cartridge* cart, byte* bios, bool bootbios);
 
 byte* load_bios(char* filename);
 
+void update_mem_pages(GBA* gba);
 void update_cart_waits(GBA* gba);
 
 int get_waitstates(GBA* gba, word addr, bool w, bool seq);
 int get_fetch_waitstates(GBA* gba, word addr, bool w, bool seq);
 
+// bios, ewram and iwram fetches skip the cart prefetch logic entirely
+static inline int get_fetch_waitstates_fast(GBA* gba, word addr, bool w,
+                                            bool seq) {
+    word region = addr >> 24;
+    if (region >= R_ROM0) return get_fetch_waitstates(gba, addr, w, seq);
+    int waits = gba->waitstates[w][seq][region];
+    if (gba->io.waitcnt.prefetch || !gba->prefetch_halted)
+        gba->prefetcher_cycles += waits;
+    return waits;
+}
+
 byte bus_readb(GBA* gba, word addr);
 hword bus_readh(GBA* gba, word addr);
 word bus_readw(GBA* gba, word addr);
@@ -125,11 +170,31 @@ void bus_writeh(GBA* gba, word addr, hword h);
 void bus_writew(GBA* gba, word addr, word w);
 
 void bus_lock(GBA* gba);
-void bus_unlock(GBA* gba, int dma_prio);
-
-void tick_components(GBA* gba, int cycles, bool mem);
-
-void gba_step(GBA* gba);
+void bus_run_waiting_dma(GBA* gba, int dma_prio);
+
+static inline void bus_unlock(GBA* gba, int dma_prio) {
+    gba->bus_locks = 0;
+    if (gba->dmac.dma[0].waiting | gba->dmac.dma[1].waiting |
+        gba->dmac.dma[2].waiting | gba->dmac.dma[3].waiting)
+        bus_run_waiting_dma(gba, dma_prio);
+}
+
+static inline void tick_components(GBA* gba, int cycles, bool mem) {
+    Scheduler* sched = &gba->sched;
+    // no event is due so neither scheduler loop would do anything
+    if (!sched->n_events || sched->event_queue[0].time > sched->now + cycles) {
+        sched->now += cycles;
+        return;
+    }
+    if (mem) {
+        run_scheduler_mem(sched, cycles);
+    } else {
+        run_scheduler_internal(sched, cycles);
+    }
+}
+
+// returns the number of instructions executed
+int gba_step(GBA* gba);
 
 void update_keypad_irq(GBA* gba);
 
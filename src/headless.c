@@ -0,0 +1,332 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "apu.h"
+#include "emulator.h"
+#include "gba.h"
+#include "types.h"
+
+enum {
+    EXIT_OK,
+    EXIT_LOAD_FAILED,
+    EXIT_NOT_REACHED,
+    EXIT_MOVIE_DESYNC,
+    EXIT_CHECK_FAILED
+};
+
+const char headless_usage[] =
+    "agbemu-headless [options] <romfile>\n"
+    "-n <frames> -- number of frames to run (default 600)\n"
+    "-e <addr> -- stop once execution reaches addr\n"
+    "-o <file> -- write frames, cycles and the framebuffer hash to file\n"
+    "-s <file> -- write the last frame to file as a ppm image\n"
+    "-a <file> -- write the audio output to file as a wav\n"
+    "-r <file> -- replay a movie made with --record and check it stays in\n"
+    "sync, runs for the length of the movie\n"
+    "--check -- hold down scripted keys while running, then check that\n"
+    "loading a state and running again gives the same result and that\n"
+    "rewinding gives back every state exactly, with --record the movie\n"
+    "holds the scripted keys so replaying it with -r checks it as well\n"
+    "-b, -f, -t, --bench, --frameskip and --no-video work the same as in\n"
+    "agbemu, the last frame is always drawn unless --no-video is given\n"
+    "exits with 0 on success, 1 if the rom or bios could not be loaded,\n"
+    "2 if the -e address was never reached, 3 if the movie went out of sync\n"
+    "and 4 if a --check failed\n";
+
+struct {
+    int frames;
+    bool has_exit_addr;
+    word exit_addr;
+    char* hashfile;
+    char* screenshotfile;
+    char* audiofile;
+    char* moviefile;
+    bool check;
+} headless = {.frames = 600};
+
+// takes out the headless options and leaves the rest for read_args
+int read_headless_args(int argc, char** argv) {
+    int n = 1;
+    for (int i = 1; i < argc; i++) {
+        char* opt = argv[i];
+        if (!strcmp(opt, "--check")) {
+            headless.check = true;
+        } else if (opt[0] == '-' && opt[1] && !opt[2] &&
+                   strchr("neosar", opt[1]) && i + 1 < argc) {
+            char* val = argv[++i];
+            switch (opt[1]) {
+                case 'n':
+                    headless.frames = atoi(val);
+                    break;
+                case 'e':
+                    headless.has_exit_addr = true;
+                    headless.exit_addr = strtoul(val, NULL, 0);
+                    break;
+                case 'o':
+                    headless.hashfile = val;
+                    break;
+                case 's':
+                    headless.screenshotfile = val;
+                    break;
+                case 'a':
+                    headless.audiofile = val;
+                    break;
+                case 'r':
+                    headless.moviefile = val;
+                    break;
+            }
+        } else {
+            argv[n++] = opt;
+        }
+    }
+    return n;
+}
+
+dword hash_bytes(dword h, const void* data, size_t size) {
+    const byte* p = data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+dword hash_screen(PPU* ppu) {
+    return hash_bytes(0xcbf29ce484222325, ppu->screen, sizeof ppu->screen);
+}
+
+// one key at a time for 8 frames out of every 16 so games waiting for both a
+// press and a release get to see them
+hword check_keys(int frame) {
+    return frame % 16 < 8 ? 1 << (frame / 16 % 10) : 0;
+}
+
+void run_check_frames(int first, int n) {
+    for (int i = first; i < first + n; i++) {
+        agbemu_set_keys(agbemu.emu, check_keys(i));
+        if (!agbemu_run_frame(agbemu.emu)) break;
+        agbemu_drain_audio(agbemu.emu, NULL, SIZE_MAX);
+    }
+}
+
+// the whole state and the screen, buf has to hold a state
+dword hash_state(byte* buf, size_t size) {
+    agbemu_serialize(agbemu.emu, buf, size);
+    dword h = hash_bytes(0xcbf29ce484222325, buf, size);
+    return hash_bytes(h, agbemu_framebuffer(agbemu.emu),
+                      sizeof agbemu.gba->ppu.screen);
+}
+
+// saves a state, runs, loads it and runs the same frames again, the state is
+// saved partway through a frame since a lot of it is the same at every vblank
+bool check_state(int frames) {
+    agbemu_run_cycles(agbemu.emu, AGBEMU_CYCLES_PER_FRAME / 3);
+    size_t size = agbemu_serialize(agbemu.emu, NULL, 0);
+    byte* start = malloc(size);
+    byte* buf = malloc(size);
+    agbemu_serialize(agbemu.emu, start, size);
+    run_check_frames(0, frames);
+    dword first = hash_state(buf, size);
+    bool ok = agbemu_deserialize(agbemu.emu, start, size);
+    if (ok) {
+        run_check_frames(0, frames);
+        ok = hash_state(buf, size) == first;
+    }
+    printf("state check %s\n", ok ? "ok" : "failed");
+    free(start);
+    free(buf);
+    return ok;
+}
+
+// takes a snapshot every frame and steps back through all of them, each one
+// has to come back exactly as it was taken
+bool check_rewind(int frames) {
+    size_t size = agbemu_serialize(agbemu.emu, NULL, 0);
+    byte* buf = malloc(size);
+    dword* hashes = malloc((frames + 1) * sizeof *hashes);
+    Rewind* r = create_rewind(agbemu.gba, (size_t) 256 << 20, 1);
+    hashes[0] = hash_state(buf, size);
+    for (int i = 1; i <= frames; i++) {
+        run_check_frames(i, 1);
+        rewind_frame(r, agbemu.gba);
+        hashes[i] = hash_state(buf, size);
+    }
+    int bad = -1;
+    for (int i = frames - 1; i >= 0 && bad < 0; i--) {
+        if (!rewind_step(r, agbemu.gba) || hash_state(buf, size) != hashes[i])
+            bad = i;
+    }
+    if (bad < 0) printf("rewind check ok\n");
+    else printf("rewind check failed at frame %d\n", bad);
+    destroy_rewind(r);
+    free(hashes);
+    free(buf);
+    return bad < 0;
+}
+
+bool run_checks(int frames) {
+    agbemu_skip_draw(agbemu.emu, agbemu.no_video);
+    if (frames < 1) frames = 1;
+    bool ok = check_state(frames);
+    return check_rewind(frames) && ok;
+}
+
+void write_screenshot(char* filename, PPU* ppu) {
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) {
+        printf("Could not open %s\n", filename);
+        return;
+    }
+    static word pixels[GBA_SCREEN_W * GBA_SCREEN_H];
+    gba_convert_screen((hword*) ppu->screen, pixels, PIXFMT_ARGB8888);
+    fprintf(fp, "P6\n%d %d\n255\n", GBA_SCREEN_W, GBA_SCREEN_H);
+    for (int i = 0; i < GBA_SCREEN_W * GBA_SCREEN_H; i++) {
+        byte rgb[3] = {pixels[i] >> 16, pixels[i] >> 8, pixels[i]};
+        fwrite(rgb, 1, 3, fp);
+    }
+    fclose(fp);
+}
+
+// 32 bit float stereo wav, the sizes are filled in when the file is closed
+void write_wav_header(FILE* fp, word data_size) {
+    struct {
+        char riff[4];
+        word riff_size;
+        char wave[4];
+        char fmt[4];
+        word fmt_size;
+        hword format;
+        hword channels;
+        word rate;
+        word byte_rate;
+        hword block_align;
+        hword bits;
+        char data[4];
+        word data_size;
+    } header = {{'R', 'I', 'F', 'F'},
+                36 + data_size,
+                {'W', 'A', 'V', 'E'},
+                {'f', 'm', 't', ' '},
+                16,
+                3,
+                2,
+                SAMPLE_FREQ,
+                SAMPLE_FREQ * 2 * sizeof(float),
+                2 * sizeof(float),
+                8 * sizeof(float),
+                {'d', 'a', 't', 'a'},
+                data_size};
+    fseek(fp, 0, SEEK_SET);
+    fwrite(&header, sizeof header, 1, fp);
+}
+
+int main(int argc, char** argv) {
+    argc = read_headless_args(argc, argv);
+    if (argc < 2) {
+        printf(headless_usage);
+        return EXIT_LOAD_FAILED;
+    }
+    if (emulator_init(argc, argv) < 0) return EXIT_LOAD_FAILED;
+
+    if (agbemu.bench_frames) {
+        emulator_bench();
+        emulator_quit();
+        return EXIT_OK;
+    }
+
+    GBA* gba = agbemu.gba;
+    Movie* movie = NULL;
+    if (headless.moviefile) {
+        movie = movie_load(headless.moviefile);
+        if (!movie) {
+            printf("Could not read movie %s\n", headless.moviefile);
+            emulator_quit();
+            return EXIT_LOAD_FAILED;
+        }
+        if (!movie_start_playback(movie, gba)) {
+            printf("Movie was recorded with a different rom\n");
+            destroy_movie(movie);
+            emulator_quit();
+            return EXIT_LOAD_FAILED;
+        }
+        headless.frames = movie->h.frames;
+    }
+    FILE* audiofp = NULL;
+    word audio_size = 0;
+    if (headless.audiofile) {
+        audiofp = fopen(headless.audiofile, "wb");
+        if (audiofp) write_wav_header(audiofp, 0);
+        else printf("Could not open %s\n", headless.audiofile);
+    }
+
+    static float samples[16 * SAMPLE_BUF_LEN];
+    int status = EXIT_OK;
+    bool reached = false;
+    int frame = 0;
+    while (frame < headless.frames && !reached && !gba->stop) {
+        emulator_frame_start(frame);
+        if (frame == headless.frames - 1 && !agbemu.no_video) {
+            agbemu_skip_draw(agbemu.emu, false);
+        }
+        if (movie && !movie_frame_start(movie, gba)) break;
+        if (agbemu.movie) movie_frame_start(agbemu.movie, gba);
+        if (headless.check && !movie) emulator_set_keys(check_keys(frame));
+        while (!gba->stop && !gba->ppu.frame_complete) {
+            if (headless.has_exit_addr &&
+                gba->cpu.cur_instr_addr == headless.exit_addr) {
+                reached = true;
+                break;
+            }
+            agbemu_step(agbemu.emu);
+        }
+        size_t n = agbemu_drain_audio(agbemu.emu, samples, SIZE_MAX);
+        if (audiofp) {
+            fwrite(samples, sizeof *samples, n, audiofp);
+            audio_size += n * sizeof *samples;
+        }
+        if (gba->ppu.frame_complete) {
+            gba->ppu.frame_complete = false;
+            frame++;
+            if (movie) movie_frame_end(movie, gba);
+            if (agbemu.movie) movie_frame_end(agbemu.movie, gba);
+        }
+    }
+    if (headless.has_exit_addr && !reached) status = EXIT_NOT_REACHED;
+    if (movie) {
+        if (movie->desync_frame >= 0) {
+            printf("movie out of sync by frame %ld\n", movie->desync_frame);
+            status = EXIT_MOVIE_DESYNC;
+        } else printf("movie in sync for %d frames\n", frame);
+        destroy_movie(movie);
+    }
+
+    // the -e address can be reached partway through a frame
+    agbemu_framebuffer(agbemu.emu);
+    dword hash = hash_screen(&gba->ppu);
+    printf("frames %d cycles %lu hash %016lx\n", frame, gba->sched.now, hash);
+    if (headless.hashfile) {
+        FILE* fp = fopen(headless.hashfile, "w");
+        if (fp) {
+            fprintf(fp, "frames %d cycles %lu hash %016lx\n", frame,
+                    gba->sched.now, hash);
+            fclose(fp);
+        } else printf("Could not open %s\n", headless.hashfile);
+    }
+    if (headless.screenshotfile) {
+        write_screenshot(headless.screenshotfile, &gba->ppu);
+    }
+    if (audiofp) {
+        write_wav_header(audiofp, audio_size);
+        fclose(audiofp);
+    }
+    // the output above is for the main run, the checks carry on from there and
+    // are left out of a movie being recorded
+    if (headless.check && !gba->stop && !run_checks(headless.frames / 4)) {
+        status = EXIT_CHECK_FAILED;
+    }
+
+    emulator_quit();
+
+    return status;
+}
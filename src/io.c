@@ -79,6 +79,10 @@ hword io_readh(IO* io, word addr) {
         io->master->openbus = true;
         return 0;
     }
+    // the channel status bits and the wave ram banks change as the apu runs
+    if (addr == SOUNDCNT_X || (WAVERAM <= addr && addr < FIFO_A)) {
+        apu_sync(&io->master->apu);
+    }
     switch (addr) {
         case SOUND1CNT_X:
         case SOUND2CNT_H:
@@ -97,6 +101,7 @@ hword io_readh(IO* io, word addr) {
 }
 
 void io_writeh(IO* io, word addr, hword data) {
+    if (SOUND1CNT_L <= addr && addr < FIFO_A) apu_sync(&io->master->apu);
     if ((addr & ~0b11) == BG2X || (addr & ~0b11) == BG2Y ||
         (addr & ~0b11) == BG3X || (addr & ~0b11) == BG3Y ||
         (addr & ~0b11) == FIFO_A || (addr & ~0b11) == FIFO_B) {
@@ -160,8 +165,7 @@ void io_writeh(IO* io, word addr, hword data) {
                 io->master->apu.ch1_volume = (io->nr12 & NRX2_VOL) >> 4;
                 io->master->apu.ch1_sweep_pace = (io->nr10 & NR10_PACE) >> 4;
                 io->master->apu.ch1_sweep_counter = 0;
-                remove_event(&io->master->sched, EVENT_APU_CH1_REL);
-                ch1_reload(&io->master->apu);
+                apu_trigger_reload(&io->master->apu, 0);
             }
             io->nr14 |= data & NRX4_LEN_ENABLE;
             break;
@@ -187,8 +191,7 @@ void io_writeh(IO* io, word addr, hword data) {
                 io->master->apu.ch2_env_pace = io->nr22 & NRX2_PACE;
                 io->master->apu.ch2_env_dir = io->nr22 & NRX2_DIR;
                 io->master->apu.ch2_volume = (io->nr22 & NRX2_VOL) >> 4;
-                remove_event(&io->master->sched, EVENT_APU_CH2_REL);
-                ch2_reload(&io->master->apu);
+                apu_trigger_reload(&io->master->apu, 1);
             }
             io->nr24 |= data & NRX4_LEN_ENABLE;
             break;
@@ -212,8 +215,7 @@ void io_writeh(IO* io, word addr, hword data) {
             if ((io->nr30 & 0b10000000) && (data & NRX4_TRIGGER)) {
                 io->master->apu.ch3_enable = true;
                 io->master->apu.ch3_sample_index = 0;
-                remove_event(&io->master->sched, EVENT_APU_CH3_REL);
-                ch3_reload(&io->master->apu);
+                apu_trigger_reload(&io->master->apu, 2);
             }
             io->nr34 |= data & NRX4_LEN_ENABLE;
             break;
@@ -237,8 +239,7 @@ void io_writeh(IO* io, word addr, hword data) {
                 io->master->apu.ch4_env_pace = io->nr42 & NRX2_PACE;
                 io->master->apu.ch4_env_dir = io->nr42 & NRX2_DIR;
                 io->master->apu.ch4_volume = (io->nr42 & NRX2_VOL) >> 4;
-                remove_event(&io->master->sched, EVENT_APU_CH4_REL);
-                ch4_reload(&io->master->apu);
+                apu_trigger_reload(&io->master->apu, 3);
             }
             io->nr44 = data & NRX4_LEN_ENABLE;
             break;
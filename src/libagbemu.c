@@ -0,0 +1,191 @@
+#include "libagbemu.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arm_isa.h"
+#include "gba.h"
+#include "renderer.h"
+#include "savestate.h"
+#include "thumb_isa.h"
+
+// about a quarter second, the oldest samples are dropped past this
+#define AUDIO_BUF_LEN (16 * SAMPLE_BUF_LEN)
+
+typedef struct _Agbemu {
+    GBA* gba;
+    Cartridge* cart;
+    byte* bios;
+    Renderer* renderer;
+    bool boot_bios;
+
+    float audio[AUDIO_BUF_LEN];
+    size_t audio_len;
+} Agbemu;
+
+// the instruction lookup tables and the apu's step table are the only thing
+// shared between instances and never change once generated
+static pthread_once_t lookups_once = PTHREAD_ONCE_INIT;
+
+static void generate_lookups() {
+    arm_generate_lookup();
+    thumb_generate_lookup();
+    apu_generate_blip();
+}
+
+static Agbemu* create_instance(Cartridge* cart, byte* bios,
+                               const AgbemuConfig* cfg) {
+    pthread_once(&lookups_once, generate_lookups);
+
+    AgbemuConfig defaults = {0};
+    if (!cfg) cfg = &defaults;
+
+    Agbemu* e = calloc(1, sizeof *e);
+    GBA* gba = malloc(sizeof *gba);
+    if (!e || !gba) {
+        free(e);
+        free(gba);
+        destroy_cartridge(cart);
+        free(bios);
+        return NULL;
+    }
+    e->gba = gba;
+    e->cart = cart;
+    e->bios = bios;
+    e->boot_bios = cfg->boot_bios;
+    init_gba(e->gba, cart, bios, cfg->boot_bios);
+
+    if (cfg->threaded_render) {
+        e->renderer = create_renderer();
+        if (e->renderer) renderer_attach(e->renderer, e->gba);
+    }
+    return e;
+}
+
+Agbemu* agbemu_create(const void* rom, size_t rom_size, const void* bios,
+                      size_t bios_size, const AgbemuConfig* cfg) {
+    if (rom_size == 0 || rom_size > ROM_MAX_SIZE) return NULL;
+    if (bios_size != BIOS_SIZE) return NULL;
+    Cartridge* cart = create_cartridge_mem(rom, rom_size);
+    if (!cart) return NULL;
+    byte* bios_copy = malloc(BIOS_SIZE);
+    if (!bios_copy) {
+        destroy_cartridge(cart);
+        return NULL;
+    }
+    memcpy(bios_copy, bios, BIOS_SIZE);
+    return create_instance(cart, bios_copy, cfg);
+}
+
+Agbemu* agbemu_open(const char* romfile, const char* biosfile,
+                    const AgbemuConfig* cfg) {
+    Cartridge* cart = create_cartridge((char*) romfile);
+    if (!cart) return NULL;
+    byte* bios = load_bios((char*) biosfile);
+    if (!bios) {
+        destroy_cartridge(cart);
+        return NULL;
+    }
+    return create_instance(cart, bios, cfg);
+}
+
+void agbemu_destroy(Agbemu* e) {
+    if (!e) return;
+    destroy_renderer(e->renderer);
+    destroy_cartridge(e->cart);
+    free(e->bios);
+    free(e->gba);
+    free(e);
+}
+
+void agbemu_reset(Agbemu* e) {
+    if (e->renderer) renderer_sync(e->renderer);
+    init_gba(e->gba, e->cart, e->bios, e->boot_bios);
+    if (e->renderer) renderer_attach(e->renderer, e->gba);
+    e->audio_len = 0;
+}
+
+static void take_samples(Agbemu* e) {
+    APU* apu = &e->gba->apu;
+    if (e->audio_len + SAMPLE_BUF_LEN > AUDIO_BUF_LEN) {
+        memmove(e->audio, e->audio + SAMPLE_BUF_LEN,
+                (e->audio_len - SAMPLE_BUF_LEN) * sizeof *e->audio);
+        e->audio_len -= SAMPLE_BUF_LEN;
+    }
+    memcpy(e->audio + e->audio_len, apu->sample_buf, sizeof apu->sample_buf);
+    e->audio_len += SAMPLE_BUF_LEN;
+    apu->samples_full = false;
+}
+
+int agbemu_step(Agbemu* e) {
+    int instrs = gba_step(e->gba);
+    if (e->gba->apu.samples_full) take_samples(e);
+    return instrs;
+}
+
+bool agbemu_run_frame(Agbemu* e) {
+    GBA* gba = e->gba;
+    while (!gba->stop && !gba->ppu.frame_complete) agbemu_step(e);
+    bool complete = gba->ppu.frame_complete;
+    gba->ppu.frame_complete = false;
+    return complete;
+}
+
+bool agbemu_stopped(Agbemu* e) {
+    return e->gba->stop;
+}
+
+uint64_t agbemu_run_cycles(Agbemu* e, uint64_t cycles) {
+    GBA* gba = e->gba;
+    dword start = gba->sched.now;
+    while (!gba->stop && gba->sched.now - start < cycles) {
+        // a halted cpu only runs until the end of the frame
+        gba->ppu.frame_complete = false;
+        agbemu_step(e);
+    }
+    gba->ppu.frame_complete = false;
+    return gba->sched.now - start;
+}
+
+void agbemu_set_keys(Agbemu* e, uint16_t pressed) {
+    e->gba->io.keyinput.keys = ~pressed & 0x3ff;
+    update_keypad_irq(e->gba);
+}
+
+const uint16_t* agbemu_framebuffer(Agbemu* e) {
+    if (e->renderer) renderer_sync(e->renderer);
+    return &e->gba->ppu.screen[0][0];
+}
+
+bool agbemu_screen_changed(Agbemu* e) {
+    if (e->renderer) renderer_sync(e->renderer);
+    bool changed = e->gba->ppu.screen_changed;
+    e->gba->ppu.screen_changed = false;
+    return changed;
+}
+
+void agbemu_skip_draw(Agbemu* e, bool skip) {
+    e->gba->ppu.skip_draw = skip;
+}
+
+size_t agbemu_drain_audio(Agbemu* e, float* samples, size_t max) {
+    // whole stereo pairs only
+    size_t n = (e->audio_len < max ? e->audio_len : max) & ~(size_t) 1;
+    if (samples) memcpy(samples, e->audio, n * sizeof *samples);
+    memmove(e->audio, e->audio + n, (e->audio_len - n) * sizeof *e->audio);
+    e->audio_len -= n;
+    return n;
+}
+
+size_t agbemu_serialize(Agbemu* e, void* buf, size_t size) {
+    return gba_serialize(e->gba, buf, size);
+}
+
+bool agbemu_deserialize(Agbemu* e, const void* buf, size_t size) {
+    return gba_deserialize(e->gba, buf, size);
+}
+
+GBA* agbemu_gba(Agbemu* e) {
+    return e->gba;
+}
@@ -0,0 +1,80 @@
+#ifndef LIBAGBEMU_H
+#define LIBAGBEMU_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// embedding api, every call takes the handle so any number of instances can
+// run in one process, only standard types are used so this header stands alone
+
+#define AGBEMU_SCREEN_W 240
+#define AGBEMU_SCREEN_H 160
+#define AGBEMU_SAMPLE_RATE 32768
+#define AGBEMU_CYCLES_PER_FRAME 280896
+
+// bits of the pressed keys mask, in the order of the keyinput register
+enum {
+    AGBEMU_KEY_A = 1 << 0,
+    AGBEMU_KEY_B = 1 << 1,
+    AGBEMU_KEY_SELECT = 1 << 2,
+    AGBEMU_KEY_START = 1 << 3,
+    AGBEMU_KEY_RIGHT = 1 << 4,
+    AGBEMU_KEY_LEFT = 1 << 5,
+    AGBEMU_KEY_UP = 1 << 6,
+    AGBEMU_KEY_DOWN = 1 << 7,
+    AGBEMU_KEY_R = 1 << 8,
+    AGBEMU_KEY_L = 1 << 9
+};
+
+typedef struct {
+    bool boot_bios;
+    // draw scanlines on a thread of its own
+    bool threaded_render;
+} AgbemuConfig;
+
+typedef struct _Agbemu Agbemu;
+
+// the rom and bios are copied, cfg can be NULL for the defaults, returns NULL
+// if the rom is empty or over 32mb, the bios is not 16kb or out of memory
+Agbemu* agbemu_create(const void* rom, size_t rom_size, const void* bios,
+                      size_t bios_size, const AgbemuConfig* cfg);
+// maps the rom and keeps its save memory in a .sav file next to it
+Agbemu* agbemu_open(const char* romfile, const char* biosfile,
+                    const AgbemuConfig* cfg);
+void agbemu_destroy(Agbemu* e);
+
+void agbemu_reset(Agbemu* e);
+
+// runs until the end of the next frame, false if the system is stopped
+bool agbemu_run_frame(Agbemu* e);
+// stopped by the game until a key or cartridge interrupt wakes it up
+bool agbemu_stopped(Agbemu* e);
+// runs at least cycles cycles unless stopped and returns how many were run
+uint64_t agbemu_run_cycles(Agbemu* e, uint64_t cycles);
+// runs one instruction or one halted stretch and returns the number of
+// instructions executed
+int agbemu_step(Agbemu* e);
+
+void agbemu_set_keys(Agbemu* e, uint16_t pressed);
+
+// bgr555 pixels, AGBEMU_SCREEN_W by AGBEMU_SCREEN_H
+const uint16_t* agbemu_framebuffer(Agbemu* e);
+// whether any line of the framebuffer was drawn since the last call
+bool agbemu_screen_changed(Agbemu* e);
+// frames run while set keep all their timing, interrupts and dmas but leave
+// the framebuffer alone
+void agbemu_skip_draw(Agbemu* e, bool skip);
+
+// copies out up to max interleaved stereo samples produced since the last
+// call and returns how many, samples is allowed to be NULL to throw them away
+size_t agbemu_drain_audio(Agbemu* e, float* samples, size_t max);
+
+// same format and rules as gba_serialize and gba_deserialize
+size_t agbemu_serialize(Agbemu* e, void* buf, size_t size);
+bool agbemu_deserialize(Agbemu* e, const void* buf, size_t size);
+
+// for frontends built along with the emulator that need the internals
+struct _GBA* agbemu_gba(Agbemu* e);
+
+#endif
@@ -5,6 +5,7 @@
 
 #include "apu.h"
 #include "arm_isa.h"
+#include "audio.h"
 #include "cartridge.h"
 #include "debugger.h"
 #include "emulator.h"
@@ -13,6 +14,8 @@
 #include "types.h"
 
 char wintitle[200];
+// the texture has to be redrawn even if no line changed
+static bool redraw;
 
 static inline void center_screen_in_window(int windowW, int windowH,
                                            SDL_Rect* dst) {
@@ -29,10 +32,101 @@ static inline void center_screen_in_window(int windowW, int windowH,
     }
 }
 
+static void audio_callback(void* userdata, Uint8* stream, int len) {
+    audio_pull(*(AudioBuffer**) userdata, (float*) stream, len / sizeof(float));
+}
+
+static void hotkey_press(SDL_KeyCode key) {
+    switch (key) {
+        case SDLK_p:
+            agbemu.pause = !agbemu.pause;
+            break;
+        case SDLK_m:
+            agbemu.mute = !agbemu.mute;
+            break;
+        case SDLK_f:
+            agbemu.filter = !agbemu.filter;
+            redraw = true;
+            break;
+        case SDLK_r:
+            // the movie only has the inputs, so anything else that changes
+            // the state would desync it
+            if (agbemu.movie) {
+                printf("Reset is off while recording a movie\n");
+                break;
+            }
+            agbemu_reset(agbemu.emu);
+            agbemu.pause = false;
+            break;
+        case SDLK_TAB:
+            agbemu.uncap = !agbemu.uncap;
+            break;
+        case SDLK_9:
+            save_state();
+            break;
+        case SDLK_0:
+            if (agbemu.movie) {
+                printf("Loading a state is off while recording a movie\n");
+                break;
+            }
+            load_state();
+            break;
+        default:
+            break;
+    }
+}
+
+static hword read_keyboard() {
+    const Uint8* keys = SDL_GetKeyboardState(NULL);
+    hword pressed = 0;
+    if (keys[SDL_SCANCODE_Z]) pressed |= AGBEMU_KEY_A;
+    if (keys[SDL_SCANCODE_X]) pressed |= AGBEMU_KEY_B;
+    if (keys[SDL_SCANCODE_RETURN]) pressed |= AGBEMU_KEY_START;
+    if (keys[SDL_SCANCODE_RSHIFT]) pressed |= AGBEMU_KEY_SELECT;
+    if (keys[SDL_SCANCODE_LEFT]) pressed |= AGBEMU_KEY_LEFT;
+    if (keys[SDL_SCANCODE_RIGHT]) pressed |= AGBEMU_KEY_RIGHT;
+    if (keys[SDL_SCANCODE_UP]) pressed |= AGBEMU_KEY_UP;
+    if (keys[SDL_SCANCODE_DOWN]) pressed |= AGBEMU_KEY_DOWN;
+    if (keys[SDL_SCANCODE_A]) pressed |= AGBEMU_KEY_L;
+    if (keys[SDL_SCANCODE_S]) pressed |= AGBEMU_KEY_R;
+    return pressed;
+}
+
+static hword read_controller(SDL_GameController* controller) {
+    static const struct {
+        SDL_GameControllerButton button;
+        hword key;
+    } map[] = {
+        {SDL_CONTROLLER_BUTTON_A, AGBEMU_KEY_A},
+        {SDL_CONTROLLER_BUTTON_X, AGBEMU_KEY_B},
+        {SDL_CONTROLLER_BUTTON_START, AGBEMU_KEY_START},
+        {SDL_CONTROLLER_BUTTON_BACK, AGBEMU_KEY_SELECT},
+        {SDL_CONTROLLER_BUTTON_DPAD_LEFT, AGBEMU_KEY_LEFT},
+        {SDL_CONTROLLER_BUTTON_DPAD_RIGHT, AGBEMU_KEY_RIGHT},
+        {SDL_CONTROLLER_BUTTON_DPAD_UP, AGBEMU_KEY_UP},
+        {SDL_CONTROLLER_BUTTON_DPAD_DOWN, AGBEMU_KEY_DOWN},
+        {SDL_CONTROLLER_BUTTON_LEFTSHOULDER, AGBEMU_KEY_L},
+        {SDL_CONTROLLER_BUTTON_RIGHTSHOULDER, AGBEMU_KEY_R},
+    };
+    hword pressed = 0;
+    for (int i = 0; i < sizeof map / sizeof map[0]; i++) {
+        if (SDL_GameControllerGetButton(controller, map[i].button)) {
+            pressed |= map[i].key;
+        }
+    }
+    return pressed;
+}
+
 int main(int argc, char** argv) {
 
     if (emulator_init(argc, argv) < 0) return -1;
 
+    if (agbemu.bench_frames) {
+        emulator_bench();
+        emulator_quit();
+        return 0;
+    }
+
     SDL_Init(SDL_INIT_VIDEO | SDL_INIT_AUDIO | SDL_INIT_GAMECONTROLLER);
 
     SDL_GameController* controller = NULL;
@@ -54,49 +148,54 @@ int main(int argc, char** argv) {
                                              SDL_TEXTUREACCESS_STREAMING,
                                              GBA_SCREEN_W, GBA_SCREEN_H);
 
-    SDL_AudioSpec audio_spec = {.freq = SAMPLE_FREQ,
+    // the buffer resamples to whatever rate the device wants, it is created
+    // after opening but the device does not call back until unpaused
+    AudioBuffer* audio_buf = NULL;
+    SDL_AudioSpec audio_spec = {.freq = 48000,
                                 .format = AUDIO_F32,
                                 .channels = 2,
-                                .samples = SAMPLE_BUF_LEN / 2};
+                                .samples = SAMPLE_BUF_LEN / 4,
+                                .callback = audio_callback,
+                                .userdata = &audio_buf};
+    SDL_AudioSpec audio_have;
     SDL_AudioDeviceID audio =
-        SDL_OpenAudioDevice(NULL, 0, &audio_spec, NULL, 0);
+        SDL_OpenAudioDevice(NULL, 0, &audio_spec, &audio_have,
+                            SDL_AUDIO_ALLOW_FREQUENCY_CHANGE);
+    audio_buf = create_audio_buffer(SAMPLE_FREQ,
+                                    audio ? audio_have.freq : SAMPLE_FREQ);
     SDL_PauseAudioDevice(audio, 0);
 
     Uint64 prev_time = SDL_GetPerformanceCounter();
     Uint64 prev_fps_update = prev_time;
     Uint64 prev_fps_frame = 0;
-    const Uint64 frame_ticks = SDL_GetPerformanceFrequency() / 60;
+    // frames are paced to the real refresh rate and the audio rate control
+    // takes up whatever drift there is between the clocks
+    const Uint64 frame_ticks = SDL_GetPerformanceFrequency() * DOTS_W *
+                               LINES_H * 4 / (1 << 24);
+    Uint64 next_frame = prev_time;
     Uint64 frame = 0;
+    static float samples[16 * SAMPLE_BUF_LEN];
 
     agbemu.running = !agbemu.debugger;
     while (true) {
         while (agbemu.running) {
             Uint64 cur_time;
             Uint64 elapsed;
+            bool rewinding =
+                agbemu.rewind && !agbemu.pause &&
+                SDL_GetKeyboardState(NULL)[SDL_SCANCODE_BACKSPACE];
+            bool stopped = agbemu_stopped(agbemu.emu);
             bool play_audio = !(agbemu.pause || agbemu.mute || agbemu.uncap ||
-                                agbemu.gba->stop) &&
-                              (agbemu.gba->io.nr52 & (1 << 7));
+                                stopped || rewinding);
 
-            if (!(agbemu.pause || agbemu.gba->stop)) {
+            if (rewinding) {
+                emulator_rewind_step();
+            } else if (!(agbemu.pause || stopped)) {
                 do {
-                    while (!agbemu.gba->stop &&
-                           !agbemu.gba->ppu.frame_complete) {
-                        if (agbemu.debugger && agbemu.gba->cpu.cur_instr_addr ==
-                                                   agbemu.breakpoint) {
-                            printf("Breakpoint hit: %#x\n", agbemu.breakpoint);
-                            goto bkpt;
-                        }
-                        gba_step(agbemu.gba);
-                        if (agbemu.gba->apu.samples_full) {
-                            if (play_audio) {
-                                SDL_QueueAudio(
-                                    audio, agbemu.gba->apu.sample_buf,
-                                    sizeof agbemu.gba->apu.sample_buf);
-                            }
-                            agbemu.gba->apu.samples_full = false;
-                        }
-                    }
-                    agbemu.gba->ppu.frame_complete = false;
+                    if (!emulator_run_frame(frame)) goto bkpt;
+                    size_t n = agbemu_drain_audio(
+                        agbemu.emu, play_audio ? samples : NULL, SIZE_MAX);
+                    if (play_audio) audio_push(audio_buf, samples, n);
                     frame++;
 
                     cur_time = SDL_GetPerformanceCounter();
@@ -104,11 +203,26 @@ int main(int argc, char** argv) {
                 } while (agbemu.uncap && elapsed < frame_ticks);
             }
 
-            void* pixels;
-            int pitch;
-            SDL_LockTexture(texture, NULL, &pixels, &pitch);
-            gba_convert_screen((hword*) agbemu.gba->ppu.screen, pixels);
-            SDL_UnlockTexture(texture);
+            if (agbemu.run_ahead && !rewinding &&
+                !(agbemu.pause || agbemu_stopped(agbemu.emu))) {
+                static hword ahead_screen[GBA_SCREEN_H][GBA_SCREEN_W];
+                emulator_run_ahead((hword*) ahead_screen);
+                void* pixels;
+                int pitch;
+                SDL_LockTexture(texture, NULL, &pixels, &pitch);
+                gba_convert_screen((hword*) ahead_screen, pixels,
+                                   PIXFMT_ARGB8888);
+                SDL_UnlockTexture(texture);
+            } else if (agbemu_screen_changed(agbemu.emu) || redraw) {
+                // the texture still holds the last frame if no line changed
+                void* pixels;
+                int pitch;
+                SDL_LockTexture(texture, NULL, &pixels, &pitch);
+                gba_convert_screen((hword*) agbemu_framebuffer(agbemu.emu),
+                                   pixels, PIXFMT_ARGB8888);
+                SDL_UnlockTexture(texture);
+                redraw = false;
+            }
 
             int windowW, windowH;
             SDL_GetWindowSize(window, &windowW, &windowH);
@@ -123,19 +237,21 @@ int main(int argc, char** argv) {
                 if (e.type == SDL_QUIT) agbemu.running = false;
                 if (e.type == SDL_KEYDOWN) hotkey_press(e.key.keysym.sym);
             }
-            update_input_keyboard(agbemu.gba);
-            if (controller) update_input_controller(agbemu.gba, controller);
-            update_keypad_irq(agbemu.gba);
+            hword pressed = read_keyboard();
+            if (controller) pressed |= read_controller(controller);
+            emulator_set_keys(pressed);
 
             cur_time = SDL_GetPerformanceCounter();
-            elapsed = cur_time - prev_time;
-            Sint64 wait = frame_ticks - elapsed;
-
-            if (play_audio) {
-                while (SDL_GetQueuedAudioSize(audio) >= 16 * SAMPLE_BUF_LEN)
-                    SDL_Delay(1);
-            } else if (wait > 0 && !agbemu.uncap) {
-                SDL_Delay(wait * 1000 / SDL_GetPerformanceFrequency());
+            next_frame += frame_ticks;
+            if (agbemu.uncap || next_frame + frame_ticks < cur_time) {
+                // too far behind to catch up
+                next_frame = cur_time;
+            } else if (next_frame > cur_time) {
+                // sleep to the nearest millisecond, next_frame is absolute so
+                // waking a little early or late never adds up and the audio
+                // rate control takes care of what is left
+                Uint64 freq = SDL_GetPerformanceFrequency();
+                SDL_Delay(((next_frame - cur_time) * 1000 + freq / 2) / freq);
             }
             cur_time = SDL_GetPerformanceCounter();
             elapsed = cur_time - prev_fps_update;
@@ -164,6 +280,7 @@ int main(int argc, char** argv) {
     if (controller) SDL_GameControllerClose(controller);
 
     SDL_CloseAudioDevice(audio);
+    destroy_audio_buffer(audio_buf);
 
     SDL_DestroyRenderer(renderer);
     SDL_DestroyWindow(window);
@@ -0,0 +1,196 @@
+#include "movie.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gba.h"
+#include "savestate.h"
+
+static dword fnv(dword h, const void* data, size_t size) {
+    const byte* p = data;
+    for (size_t i = 0; i < size; i++) {
+        h ^= p[i];
+        h *= 0x100000001b3;
+    }
+    return h;
+}
+
+dword movie_rom_hash(GBA* gba) {
+    return fnv(0xcbf29ce484222325, gba->cart->rom.b, gba->cart->rom_size);
+}
+
+// only what the game can see and the picture, so the caches and the renderer
+// thread do not matter
+static dword checkpoint_hash(GBA* gba) {
+    apu_sync(&gba->apu);
+    if (gba->renderer) renderer_sync(gba->renderer);
+    dword h = 0xcbf29ce484222325;
+    h = fnv(h, gba->cpu.r, sizeof gba->cpu.r);
+    h = fnv(h, &gba->cpu.cpsr, sizeof gba->cpu.cpsr);
+    h = fnv(h, &gba->sched.now, sizeof gba->sched.now);
+    h = fnv(h, gba->ewram.b, sizeof gba->ewram);
+    h = fnv(h, gba->iwram.b, sizeof gba->iwram);
+    h = fnv(h, gba->io.b, sizeof gba->io.b);
+    h = fnv(h, gba->pram.b, sizeof gba->pram);
+    h = fnv(h, gba->vram.b, sizeof gba->vram);
+    h = fnv(h, gba->oam.b, sizeof gba->oam);
+    h = fnv(h, gba->ppu.screen, sizeof gba->ppu.screen);
+    return h;
+}
+
+static void push_input(Movie* m, hword in) {
+    if (m->h.n_inputs == m->inputs_cap) {
+        m->inputs_cap = m->inputs_cap ? 2 * m->inputs_cap : 1024;
+        m->inputs = realloc(m->inputs, m->inputs_cap * sizeof *m->inputs);
+    }
+    m->inputs[m->h.n_inputs++] = in;
+}
+
+static void push_checkpoint(Movie* m, dword hash) {
+    if (m->h.n_checkpoints == m->checkpoints_cap) {
+        m->checkpoints_cap = m->checkpoints_cap ? 2 * m->checkpoints_cap : 64;
+        m->checkpoints = realloc(m->checkpoints,
+                                 m->checkpoints_cap * sizeof *m->checkpoints);
+    }
+    m->checkpoints[m->h.n_checkpoints++] = hash;
+}
+
+static Movie* create_movie() {
+    Movie* m = calloc(1, sizeof *m);
+    m->h.magic = MOVIE_MAGIC;
+    m->h.version = MOVIE_VERSION;
+    m->h.checkpoint_interval = MOVIE_CHECKPOINT_INTERVAL;
+    m->last_poll = -1;
+    m->desync_frame = -1;
+    return m;
+}
+
+Movie* movie_record(GBA* gba, bool from_state, bool bootbios) {
+    Movie* m = create_movie();
+    m->h.rom_hash = movie_rom_hash(gba);
+    if (from_state) {
+        m->h.flags |= MOVIE_FROM_STATE;
+        m->h.state_size = gba_serialize(gba, NULL, 0);
+        m->state = malloc(m->h.state_size);
+        gba_serialize(gba, m->state, m->h.state_size);
+    } else if (bootbios) {
+        m->h.flags |= MOVIE_BOOT_BIOS;
+    }
+    return m;
+}
+
+bool movie_save(Movie* m, char* filename) {
+    FILE* fp = fopen(filename, "wb");
+    if (!fp) return false;
+    m->h.frames = m->frame;
+    fwrite(&m->h, sizeof m->h, 1, fp);
+    fwrite(m->state, 1, m->h.state_size, fp);
+    fwrite(m->inputs, sizeof *m->inputs, m->h.n_inputs, fp);
+    fwrite(m->checkpoints, sizeof *m->checkpoints, m->h.n_checkpoints, fp);
+    fclose(fp);
+    return true;
+}
+
+Movie* movie_load(char* filename) {
+    FILE* fp = fopen(filename, "rb");
+    if (!fp) return NULL;
+    Movie* m = create_movie();
+    bool ok = fread(&m->h, sizeof m->h, 1, fp) == 1 &&
+              m->h.magic == MOVIE_MAGIC && m->h.version == MOVIE_VERSION &&
+              m->h.checkpoint_interval;
+    if (ok) {
+        m->state = malloc(m->h.state_size);
+        m->inputs = malloc(m->h.n_inputs * sizeof *m->inputs);
+        m->checkpoints = malloc(m->h.n_checkpoints * sizeof *m->checkpoints);
+        ok = fread(m->state, 1, m->h.state_size, fp) == m->h.state_size &&
+             fread(m->inputs, sizeof *m->inputs, m->h.n_inputs, fp) ==
+                 m->h.n_inputs &&
+             fread(m->checkpoints, sizeof *m->checkpoints, m->h.n_checkpoints,
+                   fp) == m->h.n_checkpoints;
+    }
+    fclose(fp);
+    if (!ok) {
+        destroy_movie(m);
+        return NULL;
+    }
+    return m;
+}
+
+void destroy_movie(Movie* m) {
+    if (!m) return;
+    free(m->state);
+    free(m->inputs);
+    free(m->checkpoints);
+    free(m);
+}
+
+bool movie_start_playback(Movie* m, GBA* gba) {
+    if (m->h.rom_hash != movie_rom_hash(gba)) return false;
+    if (m->h.flags & MOVIE_FROM_STATE) {
+        if (!gba_deserialize(gba, m->state, m->h.state_size)) return false;
+    } else {
+        Renderer* r = gba->renderer;
+        init_gba(gba, gba->cart, gba->bios.b, m->h.flags & MOVIE_BOOT_BIOS);
+        if (r) renderer_attach(r, gba);
+    }
+    m->playing = true;
+    m->frame = 0;
+    m->input_ind = 0;
+    m->run_left = 0;
+    m->desync_frame = -1;
+    return true;
+}
+
+void movie_poll(Movie* m, GBA* gba) {
+    if (m->playing) return;
+    // polls with the same keys between two frames do nothing more
+    if (m->last_poll == gba->io.keyinput.keys) return;
+    m->last_poll = gba->io.keyinput.keys;
+    push_input(m, gba->io.keyinput.keys);
+}
+
+bool movie_frame_start(Movie* m, GBA* gba) {
+    // the screen is part of the checkpoints so those frames are always drawn
+    if ((m->frame + 1) % m->h.checkpoint_interval == 0) {
+        gba->ppu.skip_draw = false;
+    }
+
+    if (m->playing) {
+        if (!m->run_left) {
+            while (m->input_ind < m->h.n_inputs &&
+                   !(m->inputs[m->input_ind] & MOVIE_FRAMES)) {
+                gba->io.keyinput.keys = m->inputs[m->input_ind++];
+                update_keypad_irq(gba);
+            }
+            if (m->input_ind == m->h.n_inputs) return false;
+            m->run_left = m->inputs[m->input_ind++] & MOVIE_MAX_RUN;
+        }
+        m->run_left--;
+        return true;
+    }
+
+    hword* last = m->h.n_inputs ? &m->inputs[m->h.n_inputs - 1] : NULL;
+    if (m->last_poll < 0 && last && (*last & MOVIE_FRAMES) &&
+        (*last & MOVIE_MAX_RUN) < MOVIE_MAX_RUN) {
+        (*last)++;
+    } else {
+        push_input(m, MOVIE_FRAMES | 1);
+    }
+    m->last_poll = -1;
+    return true;
+}
+
+void movie_frame_end(Movie* m, GBA* gba) {
+    m->frame++;
+    if (m->frame % m->h.checkpoint_interval) return;
+
+    dword hash = checkpoint_hash(gba);
+    dword i = m->frame / m->h.checkpoint_interval - 1;
+    if (!m->playing) {
+        push_checkpoint(m, hash);
+    } else if (i < m->h.n_checkpoints && m->checkpoints[i] != hash &&
+               m->desync_frame < 0) {
+        m->desync_frame = m->frame;
+    }
+}
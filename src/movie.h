@@ -0,0 +1,74 @@
+#ifndef MOVIE_H
+#define MOVIE_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+#define MOVIE_MAGIC 0x4d424741 // "AGBM"
+#define MOVIE_VERSION 1
+
+// frames between state hashes
+#define MOVIE_CHECKPOINT_INTERVAL 60
+
+enum { MOVIE_FROM_STATE = 1 << 0, MOVIE_BOOT_BIOS = 1 << 1 };
+
+// input entries are either the keys of one poll or a run of frame starts
+// with no polls in between
+#define MOVIE_FRAMES (1 << 15)
+#define MOVIE_MAX_RUN (MOVIE_FRAMES - 1)
+
+typedef struct _GBA GBA;
+
+typedef struct {
+    word magic;
+    word version;
+    word flags;
+    word checkpoint_interval;
+    dword rom_hash;
+    dword frames;
+    dword state_size;
+    dword n_inputs;
+    dword n_checkpoints;
+} MovieHeader;
+
+typedef struct {
+    MovieHeader h;
+    byte* state;
+
+    hword* inputs;
+    dword* checkpoints;
+    size_t inputs_cap;
+    size_t checkpoints_cap;
+
+    bool playing;
+    dword frame;
+    // position in inputs and frames left in the current run while playing
+    dword input_ind;
+    int run_left;
+    // last keys polled since the previous frame while recording, -1 if none
+    int last_poll;
+
+    // first frame whose checkpoint did not match, -1 if all of them did
+    sdword desync_frame;
+} Movie;
+
+dword movie_rom_hash(GBA* gba);
+
+// starts recording from the current state, or from power on in which case
+// gba must have just been initialized
+Movie* movie_record(GBA* gba, bool from_state, bool bootbios);
+bool movie_save(Movie* m, char* filename);
+Movie* movie_load(char* filename);
+void destroy_movie(Movie* m);
+
+// puts gba where the movie starts, false if it was made with another rom
+bool movie_start_playback(Movie* m, GBA* gba);
+
+// called whenever the frontend sets the keys and calls update_keypad_irq
+void movie_poll(Movie* m, GBA* gba);
+// called before and after every frame, returns false once playback is done
+bool movie_frame_start(Movie* m, GBA* gba);
+void movie_frame_end(Movie* m, GBA* gba);
+
+#endif
@@ -6,6 +6,7 @@
 #include "dma.h"
 #include "gba.h"
 #include "io.h"
+#include "renderer.h"
 #include "scheduler.h"
 
 extern bool filter;
@@ -16,6 +17,21 @@ const int SCLAYOUT[4][2][2] = {
 // size: sqr, short, long
 const int OBJLAYOUT[4][3] = {{8, 8, 16}, {16, 8, 32}, {32, 16, 32}, {64, 32, 64}};
 
+// one row of a text bg tile from the tile cache, one palette index per byte
+static inline dword text_tile_row(PPU* ppu, BgTile tile, word tile_start,
+                                  int fy, bool palmode) {
+    int y = tile.vflip ? 7 - fy : fy;
+    if (palmode) {
+        return tcache_row8(&ppu->master->tcache, ppu->master->vram.b,
+                           ((tile_start + 64 * tile.num) % 0x10000) >> 6, y,
+                           tile.hflip);
+    } else {
+        return tcache_row4(&ppu->master->tcache, ppu->master->vram.b,
+                           ((tile_start + 32 * tile.num) % 0x10000) >> 5, y,
+                           tile.hflip);
+    }
+}
+
 void render_bg_line_text(PPU* ppu, int bg) {
     if (!(ppu->master->io.dispcnt.bg_enable & (1 << bg))) return;
     ppu->draw_bg[bg] = true;
@@ -40,94 +56,56 @@ void render_bg_line_text(PPU* ppu, int bg) {
                    SCLAYOUT[ppu->master->io.bgcnt[bg].size][scy & 1][1]};
     word map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty + 2 * tx;
     BgTile tile = {ppu->master->vram.h[(map_addr % 0x10000) >> 1]};
-    if (ppu->master->io.bgcnt[bg].palmode) {
-        word tile_addr = tile_start + 64 * tile.num;
-        hword tmpfy = fy;
-        if (tile.vflip) tmpfy = 7 - fy;
-        dword row = ppu->master->vram.w[((tile_addr + 8 * tmpfy) % 0x10000) >> 2];
-        row |= (dword) ppu->master->vram.w[((tile_addr + 8 * tmpfy + 4) % 0x10000) >> 2] << 32;
-        if (tile.hflip) {
-            row = (row & 0xffffffff00000000) >> 32 | (row & 0x00000000ffffffff) << 32;
-            row = (row & 0xffff0000ffff0000) >> 16 | (row & 0x0000ffff0000ffff) << 16;
-            row = (row & 0xff00ff00ff00ff00) >> 8 | (row & 0x00ff00ff00ff00ff) << 8;
-        }
-        row >>= 8 * fx;
-        for (int x = 0; x < GBA_SCREEN_W; x++) {
-            byte col_ind = row & 0xff;
-            if (col_ind) ppu->layerlines[bg][x] = ppu->master->pram.h[col_ind] & ~(1 << 15);
-            else ppu->layerlines[bg][x] = 1 << 15;
-
-            row >>= 8;
-            fx++;
-            if (fx == 8) {
-                fx = 0;
-                tx++;
-                if (tx == 32) {
-                    tx = 0;
-                    scx++;
-                    map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty;
-                } else {
-                    map_addr += 2;
-                }
-                tile.h = ppu->master->vram.h[(map_addr % 0x10000) >> 1];
-                tile_addr = tile_start + 64 * tile.num;
-                tmpfy = fy;
-                if (tile.vflip) tmpfy = 7 - fy;
-                row = ppu->master->vram.w[((tile_addr + 8 * tmpfy) % 0x10000) >> 2];
-                row |= (dword) ppu->master->vram.w[((tile_addr + 8 * tmpfy + 4) % 0x10000) >> 2]
-                       << 32;
-                if (tile.hflip) {
-                    row = (row & 0xffffffff00000000) >> 32 | (row & 0x00000000ffffffff) << 32;
-                    row = (row & 0xffff0000ffff0000) >> 16 | (row & 0x0000ffff0000ffff) << 16;
-                    row = (row & 0xff00ff00ff00ff00) >> 8 | (row & 0x00ff00ff00ff00ff) << 8;
-                }
-            }
-        }
-    } else {
-        word tile_addr = tile_start + 32 * tile.num;
-        hword tmpfy = fy;
-        if (tile.vflip) tmpfy = 7 - fy;
-        word row = ppu->master->vram.w[((tile_addr + 4 * tmpfy) % 0x10000) >> 2];
-        if (tile.hflip) {
-            row = (row & 0xffff0000) >> 16 | (row & 0x0000ffff) << 16;
-            row = (row & 0xff00ff00) >> 8 | (row & 0x00ff00ff) << 8;
-            row = (row & 0xf0f0f0f0) >> 4 | (row & 0x0f0f0f0f) << 4;
-        }
-        row >>= 4 * fx;
-        for (int x = 0; x < GBA_SCREEN_W; x++) {
-            byte col_ind = row & 0xf;
-            if (col_ind) {
-                col_ind |= tile.palette << 4;
-                ppu->layerlines[bg][x] = ppu->master->pram.h[col_ind] & ~(1 << 15);
-            } else ppu->layerlines[bg][x] = 1 << 15;
-
-            row >>= 4;
-            fx++;
-            if (fx == 8) {
-                fx = 0;
-                tx++;
-                if (tx == 32) {
-                    tx = 0;
-                    scx++;
-                    map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty;
-                } else {
-                    map_addr += 2;
-                }
-                tile.h = ppu->master->vram.h[(map_addr % 0x10000) >> 1];
-                tile_addr = tile_start + 32 * tile.num;
-                tmpfy = fy;
-                if (tile.vflip) tmpfy = 7 - fy;
-                row = ppu->master->vram.w[((tile_addr + 4 * tmpfy) % 0x10000) >> 2];
-                if (tile.hflip) {
-                    row = (row & 0xffff0000) >> 16 | (row & 0x0000ffff) << 16;
-                    row = (row & 0xff00ff00) >> 8 | (row & 0x00ff00ff) << 8;
-                    row = (row & 0xf0f0f0f0) >> 4 | (row & 0x0f0f0f0f) << 4;
-                }
+    bool palmode = ppu->master->io.bgcnt[bg].palmode;
+    dword row = text_tile_row(ppu, tile, tile_start, fy, palmode) >> 8 * fx;
+    for (int x = 0; x < GBA_SCREEN_W; x++) {
+        byte col_ind = row & 0xff;
+        if (col_ind) {
+            if (!palmode) col_ind |= tile.palette << 4;
+            ppu->layerlines[bg][x] = ppu->master->pram.h[col_ind] & ~(1 << 15);
+        } else ppu->layerlines[bg][x] = 1 << 15;
+
+        row >>= 8;
+        fx++;
+        if (fx == 8) {
+            fx = 0;
+            tx++;
+            if (tx == 32) {
+                tx = 0;
+                scx++;
+                map_addr = map_start + 0x800 * scs[scx & 1] + 32 * 2 * ty;
+            } else {
+                map_addr += 2;
             }
+            tile.h = ppu->master->vram.h[(map_addr % 0x10000) >> 1];
+            row = text_tile_row(ppu, tile, tile_start, fy, palmode);
         }
     }
 }
 
+static sdword floor_div(sdword a, sdword b) {
+    sdword q = a / b;
+    if ((a % b) && ((a < 0) != (b < 0))) q--;
+    return q;
+}
+
+// narrows [lo, hi) to the x where 0 <= (v + d * x) >> 8 < lim
+static void clip_span(sword v, sword d, hword lim, int* lo, int* hi) {
+    sdword a, b;
+    if (d > 0) {
+        a = floor_div(-(sdword) v + d - 1, d);
+        b = floor_div(((sdword) lim << 8) - v - 1, d) + 1;
+    } else if (d < 0) {
+        a = floor_div((sdword) v - (lim << 8), -(sdword) d) + 1;
+        b = floor_div(v, -(sdword) d) + 1;
+    } else if (v >= 0 && v < lim << 8) {
+        return;
+    } else a = b = 0;
+    if (a > *lo) *lo = a;
+    if (b < *hi) *hi = b;
+    if (*hi <= *lo) *lo = *hi = 0;
+}
+
 void render_bg_line_aff(PPU* ppu, int bg, int mode) {
     if (!(ppu->master->io.dispcnt.bg_enable & (1 << bg))) return;
     ppu->draw_bg[bg] = true;
@@ -144,53 +122,63 @@ void render_bg_line_aff(PPU* ppu, int bg, int mode) {
         x0 = ppu->bgaffintr[bg - 2].x;
         y0 = ppu->bgaffintr[bg - 2].y;
     }
+    sword pa = ppu->master->io.bgaff[bg - 2].pa;
+    sword pc = ppu->master->io.bgaff[bg - 2].pc;
 
     hword size = 1 << (7 + ppu->master->io.bgcnt[bg].size);
 
-    for (int x = 0; x < GBA_SCREEN_W;
-         x++, x0 += ppu->master->io.bgaff[bg - 2].pa, y0 += ppu->master->io.bgaff[bg - 2].pc) {
-        word sx = x0 >> 8;
-        word sy = y0 >> 8;
-        if (((mode < 3) && (sx >= size || sy >= size) && !ppu->master->io.bgcnt[bg].overflow) ||
-            ((mode == 3 || mode == 4) && (sx >= GBA_SCREEN_W || sy >= GBA_SCREEN_H)) ||
-            ((mode == 5) && (sx >= 160 || sy >= 128))) {
-            ppu->layerlines[bg][x] = 1 << 15;
-            continue;
+    // the source coordinates are linear in x so the pixels inside the
+    // background are one span, everything outside it is transparent
+    int lo = 0, hi = GBA_SCREEN_W;
+    if (mode < 3) {
+        if (!ppu->master->io.bgcnt[bg].overflow) {
+            clip_span(x0, pa, size, &lo, &hi);
+            clip_span(y0, pc, size, &lo, &hi);
         }
+    } else if (mode < 5) {
+        clip_span(x0, pa, GBA_SCREEN_W, &lo, &hi);
+        clip_span(y0, pc, GBA_SCREEN_H, &lo, &hi);
+    } else {
+        clip_span(x0, pa, 160, &lo, &hi);
+        clip_span(y0, pc, 128, &lo, &hi);
+    }
 
-        byte col_ind = 0;
-        bool pal = true;
-        switch (mode) {
-            case 1:
-            case 2:
-                sx &= size - 1;
-                sy &= size - 1;
-                hword tilex = sx >> 3;
-                hword tiley = sy >> 3;
-                hword finex = sx & 0b111;
-                hword finey = sy & 0b111;
-                byte tile =
-                    ppu->master->vram.b[(map_start + tiley * (size >> 3) + tilex) % 0x10000];
-                col_ind =
-                    ppu->master->vram.b[(tile_start + 64 * tile + finey * 8 + finex) % 0x10000];
-                break;
-            case 3:
-                pal = false;
-                ppu->layerlines[bg][x] = ppu->master->vram.h[sy * GBA_SCREEN_W + sx] & ~(1 << 15);
-                break;
-            case 4:
-                col_ind = ppu->master->vram.b[bm_start + sy * GBA_SCREEN_W + sx];
-                break;
-            case 5:
-                pal = false;
-                ppu->layerlines[bg][x] =
-                    ppu->master->vram.h[(bm_start >> 1) + sy * 160 + sx] & ~(1 << 15);
-                break;
-        }
-        if (pal) {
-            if (col_ind) ppu->layerlines[bg][x] = ppu->master->pram.h[col_ind] & ~(1 << 15);
-            else ppu->layerlines[bg][x] = 1 << 15;
-        }
+    hword* line = ppu->layerlines[bg];
+    for (int x = 0; x < lo; x++) line[x] = 1 << 15;
+    for (int x = hi; x < GBA_SCREEN_W; x++) line[x] = 1 << 15;
+    x0 += lo * pa;
+    y0 += lo * pc;
+
+    byte* vram = ppu->master->vram.b;
+    hword* pram = ppu->master->pram.h;
+    switch (mode) {
+        case 1:
+        case 2:
+            for (int x = lo; x < hi; x++, x0 += pa, y0 += pc) {
+                hword sx = (x0 >> 8) & (size - 1);
+                hword sy = (y0 >> 8) & (size - 1);
+                byte tile = vram[(map_start + (sy >> 3) * (size >> 3) + (sx >> 3)) % 0x10000];
+                byte col_ind = vram[(tile_start + 64 * tile + (sy & 7) * 8 + (sx & 7)) % 0x10000];
+                line[x] = col_ind ? pram[col_ind] & ~(1 << 15) : 1 << 15;
+            }
+            break;
+        case 3:
+            for (int x = lo; x < hi; x++, x0 += pa, y0 += pc) {
+                line[x] = ppu->master->vram.h[(y0 >> 8) * GBA_SCREEN_W + (x0 >> 8)] & ~(1 << 15);
+            }
+            break;
+        case 4:
+            for (int x = lo; x < hi; x++, x0 += pa, y0 += pc) {
+                byte col_ind = vram[bm_start + (y0 >> 8) * GBA_SCREEN_W + (x0 >> 8)];
+                line[x] = col_ind ? pram[col_ind] & ~(1 << 15) : 1 << 15;
+            }
+            break;
+        case 5:
+            for (int x = lo; x < hi; x++, x0 += pa, y0 += pc) {
+                line[x] = ppu->master->vram.h[(bm_start >> 1) + (y0 >> 8) * 160 + (x0 >> 8)] &
+                          ~(1 << 15);
+            }
+            break;
     }
 }
 
@@ -223,33 +211,52 @@ void render_bgs(PPU* ppu) {
     }
 }
 
-void render_obj_line(PPU* ppu, int i) {
-    ObjAttr o = ppu->master->oam.objs[i];
-    byte w, h;
+// returns false if the object is not displayed
+static bool obj_bounds(ObjAttr o, byte* w, byte* h) {
     switch (o.shape) {
         case OBJ_SHAPE_SQR:
-            w = h = OBJLAYOUT[o.size][0];
+            *w = *h = OBJLAYOUT[o.size][0];
             break;
         case OBJ_SHAPE_HORZ:
-            w = OBJLAYOUT[o.size][2];
-            h = OBJLAYOUT[o.size][1];
+            *w = OBJLAYOUT[o.size][2];
+            *h = OBJLAYOUT[o.size][1];
             break;
         case OBJ_SHAPE_VERT:
-            w = OBJLAYOUT[o.size][1];
-            h = OBJLAYOUT[o.size][2];
+            *w = OBJLAYOUT[o.size][1];
+            *h = OBJLAYOUT[o.size][2];
             break;
         default:
-            return;
+            return false;
     }
     if (o.disable_double) {
         if (o.aff) {
-            w *= 2;
-            h *= 2;
-        } else return;
+            *w *= 2;
+            *h *= 2;
+        } else return false;
+    }
+    return true;
+}
+
+void build_objlist(PPU* ppu) {
+    memset(ppu->objlist_len, 0, sizeof ppu->objlist_len);
+    for (int i = 0; i < 128; i++) {
+        ObjAttr o = ppu->master->oam.objs[i];
+        byte w, h;
+        if (!obj_bounds(o, &w, &h)) continue;
+        for (int yofs = 0; yofs < h; yofs++) {
+            byte y = o.y + yofs;
+            if (y < GBA_SCREEN_H) ppu->objlist[y][ppu->objlist_len[y]++] = i;
+        }
     }
+    ppu->objlist_dirty = false;
+}
+
+void render_obj_line(PPU* ppu, int i) {
+    ObjAttr o = ppu->master->oam.objs[i];
+    byte w = 0, h = 0;
+    obj_bounds(o, &w, &h);
 
     byte yofs = ppu->ly - (byte) o.y;
-    if (yofs >= h) return;
 
     if (o.mosaic) {
         yofs = ppu->objmos_y - (byte) o.y;
@@ -463,8 +470,9 @@ void render_objs(PPU* ppu) {
 
     ppu->obj_cycles = (ppu->master->io.dispcnt.hblank_free ? GBA_SCREEN_W : DOTS_W) * 4 - 6;
 
-    for (int i = 0; i < 128; i++) {
-        render_obj_line(ppu, i);
+    if (ppu->objlist_dirty) build_objlist(ppu);
+    for (int i = 0; i < ppu->objlist_len[ppu->ly]; i++) {
+        render_obj_line(ppu, ppu->objlist[ppu->ly][i]);
         if (ppu->obj_cycles <= 0) break;
     }
 }
@@ -509,28 +517,121 @@ void hmosaic_obj(PPU* ppu) {
     }
 }
 
+// compose_lines works on whole lines at a time, with gcc and clang the vectors
+// are lowered to whatever simd the target has, masks are built only from
+// comparisons so they are all ones or all zeros in each lane
+#ifdef __GNUC__
+#ifdef __AVX2__
+#define LANES 16
+#else
+#define LANES 8
+#endif
+typedef hword hvec __attribute__((vector_size(2 * LANES), aligned(2)));
+#define VMASK(c) ((hvec) (c))
+#define VSPLAT(v) ((hvec) {} + (hword) (v))
+#else
+#define LANES 1
+typedef hword hvec;
+#define VMASK(c) ((hvec) - (c))
+#define VSPLAT(v) ((hword) (v))
+#endif
+
+#define VLOAD(p) (*(hvec*) (p))
+#define VSELECT(m, a, b) (((a) & (m)) | ((b) & ~(m)))
+
+static inline hvec blend_alpha(hvec c1, hvec c2, hword eva, hword evb) {
+    hvec r = ((c1 & 0x1f) * eva + (c2 & 0x1f) * evb) >> 4;
+    hvec g = ((c1 >> 5 & 0x1f) * eva + (c2 >> 5 & 0x1f) * evb) >> 4;
+    hvec b = ((c1 >> 10 & 0x1f) * eva + (c2 >> 10 & 0x1f) * evb) >> 4;
+    r = VSELECT(VMASK(r > 31), VSPLAT(31), r);
+    g = VSELECT(VMASK(g > 31), VSPLAT(31), g);
+    b = VSELECT(VMASK(b > 31), VSPLAT(31), b);
+    return b << 10 | g << 5 | r;
+}
+
+static inline hvec blend_brighten(hvec c1, hword evy) {
+    hvec r = c1 & 0x1f;
+    hvec g = c1 >> 5 & 0x1f;
+    hvec b = c1 >> 10 & 0x1f;
+    r += (31 - r) * evy >> 4;
+    g += (31 - g) * evy >> 4;
+    b += (31 - b) * evy >> 4;
+    return b << 10 | g << 5 | r;
+}
+
+static inline hvec blend_darken(hvec c1, hword evy) {
+    hvec r = c1 & 0x1f;
+    hvec g = c1 >> 5 & 0x1f;
+    hvec b = c1 >> 10 & 0x1f;
+    r -= r * evy >> 4;
+    g -= g * evy >> 4;
+    b -= b * evy >> 4;
+    return b << 10 | g << 5 | r;
+}
+
 void compose_lines(PPU* ppu) {
-    byte sorted_bgs[4];
-    byte bg_prios[4];
-    byte bgs = 0;
-    for (int i = 0; i < 4; i++) {
-        if (!ppu->draw_bg[i]) continue;
-        sorted_bgs[bgs] = i;
-        bg_prios[bgs] = ppu->master->io.bgcnt[i].priority;
-        int j = bgs;
-        bgs++;
-        while (j > 0 && bg_prios[j] < bg_prios[j - 1]) {
-            byte tmp = sorted_bgs[j];
-            sorted_bgs[j] = sorted_bgs[j - 1];
-            sorted_bgs[j - 1] = tmp;
-            tmp = bg_prios[j];
-            bg_prios[j] = bg_prios[j - 1];
-            bg_prios[j - 1] = tmp;
-            j--;
+    // the top two visible layers at each dot and their colors, filled in by
+    // drawing each layer over the previous ones from back to front, the second
+    // layer is only needed for blending
+    hword blendtop[GBA_SCREEN_W], bot[GBA_SCREEN_W];
+    hword toplayer[GBA_SCREEN_W], botlayer[GBA_SCREEN_W];
+    // layers enabled by the window at each dot with bit 5 for effects
+    hword enable[GBA_SCREEN_W];
+    hword objprio[GBA_SCREEN_W], objsemi[GBA_SCREEN_W];
+
+    bool blend = ppu->master->io.bldcnt.effect || ppu->obj_semitrans;
+    hword* top = blend ? blendtop : ppu->screen[ppu->ly];
+
+    memcpy(top, ppu->layerlines[LBD], sizeof blendtop);
+    if (blend) {
+        memset(bot, 0, sizeof bot);
+        for (int x = 0; x < GBA_SCREEN_W; x++) {
+            toplayer[x] = LBD;
+            botlayer[x] = LMAX;
+        }
+    }
+    if (ppu->master->io.dispcnt.win_enable || ppu->master->io.dispcnt.winobj_enable) {
+        for (int x = 0; x < GBA_SCREEN_W; x++) {
+            enable[x] = ppu->master->io.b[WININ + ppu->window[x]] & 0x3f;
+        }
+    } else {
+        for (int x = 0; x < GBA_SCREEN_W; x++) {
+            enable[x] = 0x3f;
+        }
+    }
+    if (ppu->draw_obj) {
+        for (int x = 0; x < GBA_SCREEN_W; x++) {
+            objprio[x] = ppu->objdotattrs[x].priority;
+            objsemi[x] = ppu->objdotattrs[x].semitrans;
+        }
+    } else memset(objsemi, 0, sizeof objsemi);
+
+    for (int p = 3; p >= 0; p--) {
+        for (int l = 3; l >= -1; l--) {
+            if (l >= 0 && (!ppu->draw_bg[l] || ppu->master->io.bgcnt[l].priority != p)) continue;
+            if (l < 0 && !ppu->draw_obj) continue;
+            // objects go in front of backgrounds with the same priority
+            int layer = l < 0 ? LOBJ : l;
+            for (int x = 0; x < GBA_SCREEN_W; x += LANES) {
+                hvec col = VLOAD(&ppu->layerlines[layer][x]);
+                hvec vis = VMASK((col >> 15 == 0) & ((VLOAD(&enable[x]) >> layer & 1) != 0));
+                if (layer == LOBJ) vis &= VMASK(VLOAD(&objprio[x]) == VSPLAT(p));
+                if (blend) {
+                    *(hvec*) &bot[x] = VSELECT(vis, VLOAD(&top[x]), VLOAD(&bot[x]));
+                    *(hvec*) &botlayer[x] =
+                        VSELECT(vis, VLOAD(&toplayer[x]), VLOAD(&botlayer[x]));
+                    *(hvec*) &toplayer[x] = VSELECT(vis, VSPLAT(layer), VLOAD(&toplayer[x]));
+                }
+                *(hvec*) &top[x] = VSELECT(vis, col, VLOAD(&top[x]));
+            }
         }
     }
 
+    if (!blend) return;
+
     byte effect = ppu->master->io.bldcnt.effect;
+    hword target1 = ppu->master->io.bldcnt.target1;
+    hword target2 = ppu->master->io.bldcnt.target2;
     byte eva = ppu->master->io.bldalpha.eva;
     byte evb = ppu->master->io.bldalpha.evb;
     byte evy = ppu->master->io.bldy.evy;
@@ -538,115 +639,30 @@ void compose_lines(PPU* ppu) {
     if (evb > 16) evb = 16;
     if (evy > 16) evy = 16;
 
-    if (effect || ppu->obj_semitrans) {
-        for (int x = 0; x < GBA_SCREEN_W; x++) {
-            byte layers[6];
-            bool win_ena =
-                ppu->master->io.dispcnt.win_enable || ppu->master->io.dispcnt.winobj_enable;
-            byte win = ppu->window[x];
-            int l = 0;
-            bool put_obj = ppu->draw_obj && !(ppu->layerlines[LOBJ][x] & (1 << 15)) &&
-                           (!win_ena || (ppu->master->io.wincnt[win].obj_enable));
-            for (int i = 0; i < bgs && l < 2; i++) {
-                if (put_obj && ppu->objdotattrs[x].priority <= bg_prios[i]) {
-                    put_obj = false;
-                    layers[l++] = LOBJ;
-                }
-                if (!(ppu->layerlines[sorted_bgs[i]][x] & (1 << 15)) &&
-                    (!win_ena || (ppu->master->io.wincnt[win].bg_enable & (1 << sorted_bgs[i])))) {
-                    layers[l++] = sorted_bgs[i];
-                }
-            }
-            if (put_obj) {
-                layers[l++] = LOBJ;
-            }
-            layers[l++] = LBD;
-
-            hword color1 = ppu->layerlines[layers[0]][x];
-
-            if (layers[0] == LOBJ && ppu->objdotattrs[x].semitrans && l > 1 &&
-                (ppu->master->io.bldcnt.target2 & (1 << layers[1]))) {
-                byte r1 = color1 & 0x1f;
-                byte g1 = (color1 >> 5) & 0x1f;
-                byte b1 = (color1 >> 10) & 0x1f;
-                hword color2 = ppu->layerlines[layers[1]][x];
-                byte r2 = color2 & 0x1f;
-                byte g2 = (color2 >> 5) & 0x1f;
-                byte b2 = (color2 >> 10) & 0x1f;
-                r1 = (eva * r1 + evb * r2) / 16;
-                if (r1 > 31) r1 = 31;
-                g1 = (eva * g1 + evb * g2) / 16;
-                if (g1 > 31) g1 = 31;
-                b1 = (eva * b1 + evb * b2) / 16;
-                if (b1 > 31) b1 = 31;
-                ppu->screen[ppu->ly][x] = (b1 << 10) | (g1 << 5) | r1;
-            } else if ((ppu->master->io.bldcnt.target1 & (1 << layers[0])) &&
-                       (!win_ena || ppu->master->io.wincnt[win].effects_enable)) {
-                byte r1 = color1 & 0x1f;
-                byte g1 = (color1 >> 5) & 0x1f;
-                byte b1 = (color1 >> 10) & 0x1f;
-                switch (effect) {
-                    case EFF_ALPHA: {
-                        if (l == 1 || !(ppu->master->io.bldcnt.target2 & (1 << layers[1]))) break;
-                        hword color2 = ppu->layerlines[layers[1]][x];
-                        byte r2 = color2 & 0x1f;
-                        byte g2 = (color2 >> 5) & 0x1f;
-                        byte b2 = (color2 >> 10) & 0x1f;
-                        r1 = (eva * r1 + evb * r2) / 16;
-                        if (r1 > 31) r1 = 31;
-                        g1 = (eva * g1 + evb * g2) / 16;
-                        if (g1 > 31) g1 = 31;
-                        b1 = (eva * b1 + evb * b2) / 16;
-                        if (b1 > 31) b1 = 31;
-                        break;
-                    }
-                    case EFF_BINC: {
-                        r1 += (31 - r1) * evy / 16;
-                        g1 += (31 - g1) * evy / 16;
-                        b1 += (31 - b1) * evy / 16;
-                        break;
-                    }
-                    case EFF_BDEC: {
-                        r1 -= r1 * evy / 16;
-                        g1 -= g1 * evy / 16;
-                        b1 -= b1 * evy / 16;
-                        break;
-                    }
-                }
-                ppu->screen[ppu->ly][x] = (b1 << 10) | (g1 << 5) | r1;
-            } else {
-                ppu->screen[ppu->ly][x] = color1;
-            }
-        }
-    } else {
-        for (int x = 0; x < GBA_SCREEN_W; x++) {
-            byte layers[6];
-            bool win_ena =
-                ppu->master->io.dispcnt.win_enable || ppu->master->io.dispcnt.winobj_enable;
-            byte win = ppu->window[x];
-            int l = 0;
-            bool put_obj = ppu->draw_obj && !(ppu->layerlines[LOBJ][x] & (1 << 15)) &&
-                           (!win_ena || (ppu->master->io.wincnt[win].obj_enable));
-
-            for (int i = 0; i < bgs; i++) {
-                if (put_obj && ppu->objdotattrs[x].priority <= bg_prios[i]) {
-                    put_obj = false;
-                    layers[l++] = LOBJ;
-                    break;
-                }
-                if (!(ppu->layerlines[sorted_bgs[i]][x] & (1 << 15)) &&
-                    (!win_ena || (ppu->master->io.wincnt[win].bg_enable & (1 << sorted_bgs[i])))) {
-                    layers[l++] = sorted_bgs[i];
-                    break;
-                }
-            }
-            if (put_obj) {
-                layers[l++] = LOBJ;
-            }
-            layers[l++] = LBD;
-
-            ppu->screen[ppu->ly][x] = ppu->layerlines[layers[0]][x];
+    for (int x = 0; x < GBA_SCREEN_W; x += LANES) {
+        hvec c1 = VLOAD(&top[x]);
+        hvec c2 = VLOAD(&bot[x]);
+        hvec l1 = VLOAD(&toplayer[x]);
+        hvec second = VMASK((target2 >> VLOAD(&botlayer[x]) & 1) != 0);
+        hvec semi = VMASK((l1 == LOBJ) & (VLOAD(&objsemi[x]) != 0)) & second;
+        hvec first = VMASK(((target1 >> l1 & 1) != 0) & ((VLOAD(&enable[x]) >> 5 & 1) != 0));
+
+        hvec alpha = blend_alpha(c1, c2, eva, evb);
+        hvec res = c1 & 0x7fff;
+        switch (effect) {
+            case EFF_ALPHA:
+                res = VSELECT(second, alpha, res);
+                break;
+            case EFF_BINC:
+                res = blend_brighten(c1, evy);
+                break;
+            case EFF_BDEC:
+                res = blend_darken(c1, evy);
+                break;
         }
+        res = VSELECT(first, res, c1);
+        res = VSELECT(semi, alpha, res);
+        *(hvec*) &ppu->screen[ppu->ly][x] = res;
     }
 }
 
@@ -678,6 +694,130 @@ void draw_scanline(PPU* ppu) {
     compose_lines(ppu);
 }
 
+// latest write to n regions from first, wrapping around at wrap
+static dword latest_gen(dword* gens, int first, int n, int wrap) {
+    dword g = 0;
+    for (int i = 0; i < n; i++) {
+        dword cur = gens[(first + i) % wrap];
+        if (cur > g) g = cur;
+    }
+    return g;
+}
+
+// number of vram blocks len bytes cover
+static inline int vram_blocks(word len) {
+    return (len + (1 << VRAM_BLOCK_BITS) - 1) >> VRAM_BLOCK_BITS;
+}
+
+// vram a bg reads, bg tiles and maps wrap around at 64kb
+static dword bg_vram_gen(PPU* ppu, int bg, bool aff) {
+    int size = ppu->master->io.bgcnt[bg].size;
+    int map = ppu->master->io.bgcnt[bg].tilemap_base;
+    int tiles = ppu->master->io.bgcnt[bg].tile_base * 0x4000 >> VRAM_BLOCK_BITS;
+    int n_map, n_tiles;
+    if (aff) {
+        n_map = vram_blocks(256 << 2 * size);
+        n_tiles = vram_blocks(256 * 64);
+    } else {
+        n_map = size == 3 ? 4 : size ? 2 : 1;
+        int tile_size = ppu->master->io.bgcnt[bg].palmode ? 64 : 32;
+        n_tiles = vram_blocks(1024 * tile_size);
+    }
+    dword g = latest_gen(ppu->vram_gen, map, n_map, 32);
+    dword t = latest_gen(ppu->vram_gen, tiles, n_tiles, 32);
+    return t > g ? t : g;
+}
+
+// fills in the latest write to every region of video memory the line's
+// enabled layers read: the maps and tiles of each bg, the bitmap, the obj
+// tiles, the palette banks in use and the oam entries on the line
+static void line_gens(PPU* ppu, LineKey* key) {
+    IO* io = &ppu->master->io;
+    dword vram = 0, pram = ppu->pram_gen[0], oam = 0;
+    int mode = io->dispcnt.bg_mode;
+    word bm_block = (io->dispcnt.frame_sel ? 0xa000 : 0) >> VRAM_BLOCK_BITS;
+
+    for (int bg = 0; bg < 4; bg++) {
+        if (!(io->dispcnt.bg_enable & (1 << bg))) continue;
+        dword g = 0;
+        if (mode == 0 || (mode == 1 && bg < 2)) {
+            g = bg_vram_gen(ppu, bg, false);
+        } else if ((mode == 1 && bg == 2) || (mode == 2 && bg >= 2)) {
+            g = bg_vram_gen(ppu, bg, true);
+        } else if (bg == 2 && mode == 3) {
+            g = latest_gen(ppu->vram_gen, 0, vram_blocks(0x12c00), 48);
+        } else if (bg == 2 && mode == 4) {
+            g = latest_gen(ppu->vram_gen, bm_block, vram_blocks(0x9600), 48);
+        } else if (bg == 2 && mode == 5) {
+            g = latest_gen(ppu->vram_gen, bm_block, vram_blocks(0xa000), 48);
+        } else continue;
+        if (g > vram) vram = g;
+        if (mode != 3 && mode != 5) {
+            dword p = latest_gen(ppu->pram_gen, 0, 16, PRAM_BANKS);
+            if (p > pram) pram = p;
+        }
+    }
+
+    if (io->dispcnt.obj_enable) {
+        if (ppu->objlist_dirty) build_objlist(ppu);
+        int first = mode > 2 ? 0x14000 >> VRAM_BLOCK_BITS
+                             : 0x10000 >> VRAM_BLOCK_BITS;
+        dword g = latest_gen(ppu->vram_gen, first, VRAM_BLOCKS - first, 48);
+        if (g > vram) vram = g;
+        key->n_objs = ppu->objlist_len[ppu->ly];
+        for (int i = 0; i < key->n_objs; i++) {
+            int n = ppu->objlist[ppu->ly][i];
+            ObjAttr o = ppu->master->oam.objs[n];
+            g = ppu->oam_gen[n];
+            if (o.aff) {
+                dword a = latest_gen(ppu->oam_gen, 4 * o.affparamind, 4, 128);
+                if (a > g) g = a;
+            }
+            if (g > oam) oam = g;
+            if (o.palmode) {
+                g = latest_gen(ppu->pram_gen, 16, 16, PRAM_BANKS);
+            } else g = ppu->pram_gen[16 + o.palette];
+            if (g > pram) pram = g;
+        }
+    }
+
+    key->vram_gen = vram;
+    key->pram_gen = pram;
+    key->oam_gen = oam;
+}
+
+// returns false if nothing the line is drawn from changed since it was last
+// drawn, so the row in screen is still correct
+bool draw_line(PPU* ppu) {
+    LineKey key;
+    memset(&key, 0, sizeof key);
+    key.valid = true;
+    key.bgmos_y = ppu->bgmos_y;
+    key.objmos_y = ppu->objmos_y;
+    key.in_win[0] = ppu->in_win[0];
+    key.in_win[1] = ppu->in_win[1];
+    key.bgaffintr[0] = ppu->bgaffintr[0];
+    key.bgaffintr[1] = ppu->bgaffintr[1];
+    if (!ppu->master->io.dispcnt.forced_blank) line_gens(ppu, &key);
+    memcpy(key.io, ppu->master->io.b, DISP_IO_SIZE);
+    if (!memcmp(&key, &ppu->linekeys[ppu->ly], sizeof key)) return false;
+    ppu->linekeys[ppu->ly] = key;
+    ppu->screen_changed = true;
+
+    if (ppu->master->io.dispcnt.forced_blank) {
+        memset(&ppu->screen[ppu->ly][0], 0xff, sizeof ppu->screen[0]);
+    } else {
+        draw_scanline(ppu);
+    }
+    return true;
+}
+
+void ppu_mark_all_dirty(PPU* ppu) {
+    ppu->pram_dirty = true;
+    ppu->oam_dirty = true;
+    memset(ppu->vram_dirty, true, sizeof ppu->vram_dirty);
+}
+
 void ppu_hdraw(PPU* ppu) {
     ppu->ly++;
     if (ppu->ly == LINES_H) {
@@ -697,6 +837,7 @@ void ppu_hdraw(PPU* ppu) {
         ppu_vblank(ppu);
     } else if (ppu->ly == LINES_H - 1) {
         ppu->master->io.dispstat.vblank = 0;
+        if (ppu->master->renderer) renderer_sync(ppu->master->renderer);
         ppu->frame_complete = true;
     }
 
@@ -713,12 +854,9 @@ void ppu_hdraw(PPU* ppu) {
         }
     }
 
-    if (ppu->ly < GBA_SCREEN_H) {
-        if (ppu->master->io.dispcnt.forced_blank) {
-            memset(&ppu->screen[ppu->ly][0], 0xff, sizeof ppu->screen[0]);
-        } else {
-            draw_scanline(ppu);
-        }
+    if (ppu->ly < GBA_SCREEN_H && !ppu->skip_draw) {
+        if (ppu->master->renderer) renderer_push_line(ppu->master->renderer, ppu);
+        else draw_line(ppu);
     }
 
     add_event(&ppu->master->sched, EVENT_PPU_HBLANK,
@@ -8,6 +8,19 @@
 #define DOTS_W 308
 #define LINES_H 228
 
+// the io registers draw_scanline reads, dispcnt through bldy
+#define DISP_IO_SIZE 0x56
+
+// granularity of the vram dirty tracking used by the renderer thread
+#define VRAM_CHUNK_BITS 10
+#define VRAM_CHUNKS (0x18000 >> VRAM_CHUNK_BITS)
+
+// granularity of the line keys, vram in screenblocks and pram in 16 color
+// banks, oam by entry
+#define VRAM_BLOCK_BITS 11
+#define VRAM_BLOCKS (0x18000 >> VRAM_BLOCK_BITS)
+#define PRAM_BANKS 32
+
 typedef union {
     hword h;
     struct {
@@ -65,6 +78,28 @@ enum { LBG0, LBG1, LBG2, LBG3, LOBJ, LBD, LMAX };
 
 enum { EFF_NONE, EFF_ALPHA, EFF_BINC, EFF_BDEC };
 
+typedef struct {
+    sword x;
+    sword y;
+    sword mosx;
+    sword mosy;
+} BgAffIntr;
+
+// everything a line is drawn from, the line is only redrawn if this changed
+typedef struct {
+    bool valid;
+    byte bgmos_y;
+    byte objmos_y;
+    bool in_win[2];
+    BgAffIntr bgaffintr[2];
+    // latest write to what the line's enabled layers read
+    dword pram_gen;
+    dword vram_gen;
+    dword oam_gen;
+    byte n_objs;
+    byte io[DISP_IO_SIZE];
+} LineKey;
+
 typedef struct _GBA GBA;
 
 typedef struct {
@@ -82,12 +117,7 @@ typedef struct {
     } objdotattrs[GBA_SCREEN_W];
     byte window[GBA_SCREEN_W];
 
-    struct {
-        sword x;
-        sword y;
-        sword mosx;
-        sword mosy;
-    } bgaffintr[2];
+    BgAffIntr bgaffintr[2];
 
     byte bgmos_y;
     byte bgmos_ct;
@@ -102,7 +132,30 @@ typedef struct {
 
     int obj_cycles;
 
+    // objects on each line in oam order, rebuilt when attr0 or attr1 change
+    byte objlist[GBA_SCREEN_H][128];
+    byte objlist_len[GBA_SCREEN_H];
+    bool objlist_dirty;
+
     bool frame_complete;
+    // lines are not drawn but everything else about them still happens
+    bool skip_draw;
+
+    // video memory written since the renderer thread last copied it
+    bool pram_dirty;
+    bool oam_dirty;
+    bool vram_dirty[VRAM_CHUNKS];
+
+    // when each region of video memory was last written, stamped from one
+    // counter so the latest write to a set of regions is the largest stamp
+    dword video_gen;
+    dword pram_gen[PRAM_BANKS];
+    dword vram_gen[VRAM_BLOCKS];
+    dword oam_gen[128];
+
+    LineKey linekeys[GBA_SCREEN_H];
+    // set when any line of the screen is redrawn, cleared by the frontend
+    bool screen_changed;
 } PPU;
 
 void render_bgs(PPU* ppu);
@@ -110,6 +163,25 @@ void render_objs(PPU* ppu);
 void render_windows(PPU* ppu);
 
 void draw_scanline(PPU* ppu);
+bool draw_line(PPU* ppu);
+
+void ppu_mark_all_dirty(PPU* ppu);
+
+static inline void ppu_write_pram(PPU* ppu, word addr) {
+    ppu->pram_dirty = true;
+    ppu->pram_gen[addr >> 5] = ++ppu->video_gen;
+}
+
+static inline void ppu_write_vram(PPU* ppu, word addr) {
+    ppu->vram_dirty[addr >> VRAM_CHUNK_BITS] = true;
+    ppu->vram_gen[addr >> VRAM_BLOCK_BITS] = ++ppu->video_gen;
+}
+
+static inline void ppu_write_oam(PPU* ppu, word addr) {
+    ppu->oam_dirty = true;
+    ppu->oam_gen[addr >> 3] = ++ppu->video_gen;
+    if (!(addr & 4)) ppu->objlist_dirty = true;
+}
 
 void ppu_hdraw(PPU* ppu);
 void ppu_vblank(PPU* ppu);
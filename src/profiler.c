@@ -0,0 +1,25 @@
+#include "profiler.h"
+
+#include <string.h>
+
+#include "scheduler.h"
+
+const char* prof_section_names[PROF_MAX] = {"cpu", "scheduler", "ppu",
+                                            "apu", "dma",       "timers"};
+
+ProfSection prof_event_section(int event) {
+    if (event < EVENT_DMA0) return PROF_TIMER;
+    if (event < EVENT_PPU_HDRAW) return PROF_DMA;
+    if (event < EVENT_APU_FLUSH) return PROF_PPU;
+    return PROF_APU;
+}
+
+void prof_start(Profiler* prof) {
+    memset(prof, 0, sizeof *prof);
+    prof->cur = PROF_CPU;
+    prof->last = prof_clock();
+}
+
+void prof_stop(Profiler* prof) {
+    prof_switch(prof, PROF_CPU);
+}
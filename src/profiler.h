@@ -0,0 +1,49 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <time.h>
+
+#include "types.h"
+
+// time is charged to whichever section is current, everything outside of
+// events and dma counts as cpu
+typedef enum {
+    PROF_CPU,
+    PROF_SCHED,
+    PROF_PPU,
+    PROF_APU,
+    PROF_DMA,
+    PROF_TIMER,
+    PROF_MAX
+} ProfSection;
+
+typedef struct {
+    ProfSection cur;
+    dword last;
+    dword time[PROF_MAX];
+} Profiler;
+
+extern const char* prof_section_names[PROF_MAX];
+
+ProfSection prof_event_section(int event);
+
+static inline dword prof_clock() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (dword) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void prof_start(Profiler* prof);
+void prof_stop(Profiler* prof);
+
+// returns the previous section so it can be switched back to
+static inline ProfSection prof_switch(Profiler* prof, ProfSection s) {
+    dword now = prof_clock();
+    prof->time[prof->cur] += now - prof->last;
+    prof->last = now;
+    ProfSection prev = prof->cur;
+    prof->cur = s;
+    return prev;
+}
+
+#endif
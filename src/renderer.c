@@ -0,0 +1,204 @@
+#include "renderer.h"
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "gba.h"
+
+// times the thread polls an empty queue before going to sleep
+#define RENDER_SPIN 4096
+
+// everything draw_scanline needs from the emulation thread for one line, video
+// memory is only copied if it changed since the previous line was pushed
+typedef struct {
+    byte ly;
+    byte bgmos_y;
+    byte objmos_y;
+    bool in_win[2];
+    BgAffIntr bgaffintr[2];
+    byte io[DISP_IO_SIZE];
+
+    bool pram_dirty;
+    bool oam_dirty;
+    bool vram_dirty[VRAM_CHUNKS];
+    byte pram[PRAM_SIZE];
+    byte oam[OAM_SIZE];
+    byte vram[VRAM_SIZE];
+} RenderLine;
+
+typedef struct _Renderer {
+    PPU* target;
+
+    // holds the thread's own copy of the io registers and video memory
+    GBA* shadow;
+
+    // single producer single consumer queue, head is only written by the
+    // emulation thread and tail by the renderer thread
+    RenderLine lines[RENDER_QUEUE_SIZE];
+    atomic_uint head;
+    atomic_uint tail;
+
+    atomic_bool sleeping;
+    atomic_bool quit;
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+    pthread_t thread;
+} Renderer;
+
+static void render_line(Renderer* r, RenderLine* l) {
+    GBA* shadow = r->shadow;
+    PPU* ppu = &shadow->ppu;
+
+    memcpy(shadow->io.b, l->io, DISP_IO_SIZE);
+    if (l->pram_dirty) {
+        memcpy(shadow->pram.b, l->pram, PRAM_SIZE);
+        ppu->video_gen++;
+        for (int i = 0; i < PRAM_BANKS; i++) ppu->pram_gen[i] = ppu->video_gen;
+    }
+    if (l->oam_dirty) {
+        memcpy(shadow->oam.b, l->oam, OAM_SIZE);
+        ppu->video_gen++;
+        for (int i = 0; i < 128; i++) ppu->oam_gen[i] = ppu->video_gen;
+        ppu->objlist_dirty = true;
+    }
+    for (int i = 0; i < VRAM_CHUNKS; i++) {
+        if (!l->vram_dirty[i]) continue;
+        word ofs = i << VRAM_CHUNK_BITS;
+        memcpy(&shadow->vram.b[ofs], &l->vram[ofs], 1 << VRAM_CHUNK_BITS);
+        tcache_write_range(&shadow->tcache, ofs, 1 << VRAM_CHUNK_BITS);
+        ppu->vram_gen[ofs >> VRAM_BLOCK_BITS] = ++ppu->video_gen;
+    }
+
+    ppu->ly = l->ly;
+    ppu->bgmos_y = l->bgmos_y;
+    ppu->objmos_y = l->objmos_y;
+    ppu->in_win[0] = l->in_win[0];
+    ppu->in_win[1] = l->in_win[1];
+    ppu->bgaffintr[0] = l->bgaffintr[0];
+    ppu->bgaffintr[1] = l->bgaffintr[1];
+
+    if (draw_line(ppu)) {
+        memcpy(r->target->screen[l->ly], ppu->screen[l->ly],
+               sizeof ppu->screen[0]);
+        r->target->screen_changed = true;
+    }
+}
+
+static bool wait_for_line(Renderer* r, unsigned tail) {
+    for (int i = 0; i < RENDER_SPIN; i++) {
+        if (atomic_load(&r->head) != tail) return true;
+    }
+    pthread_mutex_lock(&r->lock);
+    atomic_store(&r->sleeping, true);
+    while (atomic_load(&r->head) == tail && !atomic_load(&r->quit)) {
+        pthread_cond_wait(&r->wake, &r->lock);
+    }
+    atomic_store(&r->sleeping, false);
+    pthread_mutex_unlock(&r->lock);
+    return atomic_load(&r->head) != tail;
+}
+
+static void* renderer_thread(void* arg) {
+    Renderer* r = arg;
+    while (true) {
+        unsigned tail = atomic_load_explicit(&r->tail, memory_order_relaxed);
+        if (atomic_load_explicit(&r->head, memory_order_acquire) == tail) {
+            if (!wait_for_line(r, tail)) break;
+            continue;
+        }
+        render_line(r, &r->lines[tail % RENDER_QUEUE_SIZE]);
+        atomic_store_explicit(&r->tail, tail + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+Renderer* create_renderer() {
+    Renderer* r = calloc(1, sizeof *r);
+    r->shadow = calloc(1, sizeof *r->shadow);
+    r->shadow->ppu.master = r->shadow;
+    r->shadow->io.master = r->shadow;
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->wake, NULL);
+    if (pthread_create(&r->thread, NULL, renderer_thread, r)) {
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->wake);
+        free(r->shadow);
+        free(r);
+        return NULL;
+    }
+    return r;
+}
+
+void destroy_renderer(Renderer* r) {
+    if (!r) return;
+    pthread_mutex_lock(&r->lock);
+    atomic_store(&r->quit, true);
+    pthread_cond_signal(&r->wake);
+    pthread_mutex_unlock(&r->lock);
+    pthread_join(r->thread, NULL);
+    pthread_mutex_destroy(&r->lock);
+    pthread_cond_destroy(&r->wake);
+    free(r->shadow);
+    free(r);
+}
+
+void renderer_attach(Renderer* r, GBA* gba) {
+    renderer_sync(r);
+    // the new screen has nothing to do with what the thread drew before
+    memset(r->shadow->ppu.linekeys, 0, sizeof r->shadow->ppu.linekeys);
+    r->target = &gba->ppu;
+    gba->renderer = r;
+    ppu_mark_all_dirty(&gba->ppu);
+}
+
+void renderer_push_line(Renderer* r, PPU* ppu) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (head - atomic_load_explicit(&r->tail, memory_order_acquire) ==
+           RENDER_QUEUE_SIZE) {
+        sched_yield();
+    }
+
+    GBA* gba = ppu->master;
+    RenderLine* l = &r->lines[head % RENDER_QUEUE_SIZE];
+    l->ly = ppu->ly;
+    l->bgmos_y = ppu->bgmos_y;
+    l->objmos_y = ppu->objmos_y;
+    l->in_win[0] = ppu->in_win[0];
+    l->in_win[1] = ppu->in_win[1];
+    l->bgaffintr[0] = ppu->bgaffintr[0];
+    l->bgaffintr[1] = ppu->bgaffintr[1];
+    memcpy(l->io, gba->io.b, DISP_IO_SIZE);
+
+    l->pram_dirty = ppu->pram_dirty;
+    if (ppu->pram_dirty) memcpy(l->pram, gba->pram.b, PRAM_SIZE);
+    l->oam_dirty = ppu->oam_dirty;
+    if (ppu->oam_dirty) memcpy(l->oam, gba->oam.b, OAM_SIZE);
+    for (int i = 0; i < VRAM_CHUNKS; i++) {
+        l->vram_dirty[i] = ppu->vram_dirty[i];
+        if (!ppu->vram_dirty[i]) continue;
+        word ofs = i << VRAM_CHUNK_BITS;
+        memcpy(&l->vram[ofs], &gba->vram.b[ofs], 1 << VRAM_CHUNK_BITS);
+    }
+    ppu->pram_dirty = false;
+    ppu->oam_dirty = false;
+    memset(ppu->vram_dirty, false, sizeof ppu->vram_dirty);
+
+    // sequentially consistent so either this sees sleeping or the renderer
+    // sees the new head before it goes to sleep
+    atomic_store(&r->head, head + 1);
+    if (atomic_load(&r->sleeping)) {
+        pthread_mutex_lock(&r->lock);
+        pthread_cond_signal(&r->wake);
+        pthread_mutex_unlock(&r->lock);
+    }
+}
+
+void renderer_sync(Renderer* r) {
+    unsigned head = atomic_load_explicit(&r->head, memory_order_relaxed);
+    while (atomic_load_explicit(&r->tail, memory_order_acquire) != head) {
+        sched_yield();
+    }
+}
@@ -0,0 +1,23 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include "ppu.h"
+#include "types.h"
+
+#define RENDER_QUEUE_SIZE 16
+
+typedef struct _GBA GBA;
+typedef struct _Renderer Renderer;
+
+Renderer* create_renderer();
+void destroy_renderer(Renderer* r);
+
+// points the renderer at gba's screen, must be called again whenever the
+// state of gba is replaced
+void renderer_attach(Renderer* r, GBA* gba);
+
+void renderer_push_line(Renderer* r, PPU* ppu);
+// waits until every line pushed so far is on the screen
+void renderer_sync(Renderer* r);
+
+#endif
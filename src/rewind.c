@@ -0,0 +1,192 @@
+#include "rewind.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "gba.h"
+#include "savestate.h"
+
+typedef struct {
+    byte* data;
+    size_t len;
+} Delta;
+
+typedef struct _Rewind {
+    size_t budget;
+    int interval;
+    int frames;
+
+    // snapshots are a state followed by the screen, which states leave out,
+    // padded to whole dwords so they can be compared 8 bytes at a time
+    size_t state_size;
+    size_t n_words;
+    dword* cur;
+    dword* next;
+    byte* scratch;
+
+    // ring of deltas from the newest to the oldest, each one turns the state
+    // it was taken at into the one before it
+    Delta deltas[REWIND_MAX_SNAPSHOTS];
+    int first;
+    int count;
+    size_t used;
+} Rewind;
+
+static void take_snapshot(Rewind* r, GBA* gba, dword* snap) {
+    gba_serialize(gba, snap, r->state_size);
+    memcpy((byte*) snap + r->state_size, gba->ppu.screen,
+           sizeof gba->ppu.screen);
+}
+
+static void load_snapshot(Rewind* r, GBA* gba, dword* snap) {
+    gba_deserialize(gba, snap, r->state_size);
+    memcpy(gba->ppu.screen, (byte*) snap + r->state_size,
+           sizeof gba->ppu.screen);
+}
+
+Rewind* create_rewind(GBA* gba, size_t budget, int interval) {
+    Rewind* r = calloc(1, sizeof *r);
+    r->interval = interval > 0 ? interval : 1;
+    r->state_size = gba_serialize(gba, NULL, 0);
+    r->n_words = (r->state_size + sizeof gba->ppu.screen + 7) / 8;
+    r->cur = calloc(r->n_words, sizeof(dword));
+    r->next = calloc(r->n_words, sizeof(dword));
+    // every word differing from its neighbours costs 8 bytes plus 2 for the
+    // run lengths
+    size_t scratch_size = r->n_words * 10 + 16;
+    r->scratch = malloc(scratch_size);
+    take_snapshot(r, gba, r->cur);
+
+    // the full states, the scratch buffer and the ring come out of the
+    // budget too, whatever is left is for the deltas
+    size_t fixed = sizeof *r + 2 * r->n_words * sizeof(dword) + scratch_size;
+    r->budget = budget > fixed ? budget - fixed : 0;
+    return r;
+}
+
+void destroy_rewind(Rewind* r) {
+    if (!r) return;
+    for (int i = 0; i < r->count; i++) {
+        free(r->deltas[(r->first + i) % REWIND_MAX_SNAPSHOTS].data);
+    }
+    free(r->cur);
+    free(r->next);
+    free(r->scratch);
+    free(r);
+}
+
+static byte* put_len(byte* p, size_t n) {
+    while (n >= 0x80) {
+        *p++ = n | 0x80;
+        n >>= 7;
+    }
+    *p++ = n;
+    return p;
+}
+
+static byte* get_len(byte* p, size_t* n) {
+    *n = 0;
+    for (int shift = 0;; shift += 7) {
+        *n |= (size_t) (*p & 0x7f) << shift;
+        if (!(*p++ & 0x80)) break;
+    }
+    return p;
+}
+
+// runs of equal words followed by runs of the xor of differing ones
+static size_t encode_delta(dword* a, dword* b, size_t n, byte* out) {
+    byte* p = out;
+    size_t i = 0;
+    while (i < n) {
+        size_t same = i;
+        while (same < n && a[same] == b[same]) same++;
+        if (same == n) break;
+        size_t diff = same;
+        while (diff < n && a[diff] != b[diff]) diff++;
+        p = put_len(p, same - i);
+        p = put_len(p, diff - same);
+        for (size_t j = same; j < diff; j++) {
+            dword x = a[j] ^ b[j];
+            memcpy(p, &x, sizeof x);
+            p += sizeof x;
+        }
+        i = diff;
+    }
+    return p - out;
+}
+
+static void apply_delta(dword* state, Delta* d) {
+    byte* p = d->data;
+    byte* end = p + d->len;
+    size_t i = 0;
+    while (p < end) {
+        size_t same, diff;
+        p = get_len(p, &same);
+        p = get_len(p, &diff);
+        i += same;
+        for (size_t j = 0; j < diff; j++, i++) {
+            dword x;
+            memcpy(&x, p, sizeof x);
+            p += sizeof x;
+            state[i] ^= x;
+        }
+    }
+}
+
+static void drop_oldest(Rewind* r) {
+    Delta* d = &r->deltas[(r->first + r->count - 1) % REWIND_MAX_SNAPSHOTS];
+    r->used -= d->len;
+    free(d->data);
+    r->count--;
+}
+
+void rewind_frame(Rewind* r, GBA* gba) {
+    if (++r->frames < r->interval) return;
+    r->frames = 0;
+
+    take_snapshot(r, gba, r->next);
+    size_t len = encode_delta(r->next, r->cur, r->n_words, r->scratch);
+    dword* tmp = r->cur;
+    r->cur = r->next;
+    r->next = tmp;
+
+    if (len > r->budget) {
+        while (r->count) drop_oldest(r);
+        return;
+    }
+    while (r->count && (r->count == REWIND_MAX_SNAPSHOTS ||
+                        r->used + len > r->budget)) {
+        drop_oldest(r);
+    }
+
+    r->first = (r->first + REWIND_MAX_SNAPSHOTS - 1) % REWIND_MAX_SNAPSHOTS;
+    Delta* d = &r->deltas[r->first];
+    d->data = malloc(len);
+    memcpy(d->data, r->scratch, len);
+    d->len = len;
+    r->count++;
+    r->used += len;
+}
+
+bool rewind_step(Rewind* r, GBA* gba) {
+    // go back to the newest snapshot first if frames were run since it
+    if (r->frames) {
+        r->frames = 0;
+        load_snapshot(r, gba, r->cur);
+        return true;
+    }
+    if (!r->count) {
+        load_snapshot(r, gba, r->cur);
+        return false;
+    }
+
+    Delta* d = &r->deltas[r->first];
+    apply_delta(r->cur, d);
+    r->used -= d->len;
+    free(d->data);
+    r->first = (r->first + 1) % REWIND_MAX_SNAPSHOTS;
+    r->count--;
+
+    load_snapshot(r, gba, r->cur);
+    return true;
+}
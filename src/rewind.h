@@ -0,0 +1,26 @@
+#ifndef REWIND_H
+#define REWIND_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+#define REWIND_MAX_SNAPSHOTS 4096
+// frames between snapshots the frontend uses
+#define REWIND_INTERVAL 4
+
+typedef struct _GBA GBA;
+typedef struct _Rewind Rewind;
+
+// keeps a snapshot every interval frames in at most budget bytes including
+// its own buffers, the newest is stored in full and the others as deltas to
+// the one after them
+Rewind* create_rewind(GBA* gba, size_t budget, int interval);
+void destroy_rewind(Rewind* r);
+
+// called once a frame while running forwards
+void rewind_frame(Rewind* r, GBA* gba);
+// loads the previous snapshot, returns false once there are none left
+bool rewind_step(Rewind* r, GBA* gba);
+
+#endif
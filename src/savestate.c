@@ -0,0 +1,304 @@
+#include "savestate.h"
+
+#include <string.h>
+
+#include "gba.h"
+
+#define TAG(s) ((s)[0] | (s)[1] << 8 | (s)[2] << 16 | (s)[3] << 24)
+
+// every section is written, read and measured by the same function so the
+// three can never disagree
+typedef struct {
+    byte* p;
+    bool load;
+    size_t size;
+} StateIO;
+
+static void state_field(StateIO* io, void* ptr, size_t size) {
+    if (io->p) {
+        if (io->load) memcpy(ptr, io->p, size);
+        else memcpy(io->p, ptr, size);
+        io->p += size;
+    }
+    io->size += size;
+}
+
+#define FIELD(io, f) state_field(io, &(f), sizeof(f))
+
+static void cpu_state(StateIO* io, GBA* gba) {
+    Arm7TDMI* cpu = &gba->cpu;
+    FIELD(io, cpu->r);
+    FIELD(io, cpu->cpsr.w);
+    FIELD(io, cpu->spsr);
+    FIELD(io, cpu->banked_r8_12);
+    FIELD(io, cpu->banked_sp);
+    FIELD(io, cpu->banked_lr);
+    FIELD(io, cpu->banked_spsr);
+    FIELD(io, cpu->cur_instr.w);
+    FIELD(io, cpu->next_instr.w);
+    FIELD(io, cpu->cur_instr_addr);
+    FIELD(io, cpu->bus_val);
+    FIELD(io, cpu->next_seq);
+}
+
+// only what carries over from one line to the next, the line buffers, the
+// object lists and the screen are all redrawn from the rest
+static void ppu_state(StateIO* io, GBA* gba) {
+    PPU* ppu = &gba->ppu;
+    FIELD(io, ppu->ly);
+    for (int i = 0; i < 2; i++) {
+        FIELD(io, ppu->bgaffintr[i].x);
+        FIELD(io, ppu->bgaffintr[i].y);
+        FIELD(io, ppu->bgaffintr[i].mosx);
+        FIELD(io, ppu->bgaffintr[i].mosy);
+    }
+    FIELD(io, ppu->bgmos_y);
+    FIELD(io, ppu->bgmos_ct);
+    FIELD(io, ppu->objmos_y);
+    FIELD(io, ppu->objmos_ct);
+    FIELD(io, ppu->in_win);
+}
+
+// the fifo log is always empty here since the apu is synced first
+static void apu_state(StateIO* io, GBA* gba) {
+    APU* apu = &gba->apu;
+    FIELD(io, apu->apu_div);
+    for (int i = 0; i < 4; i++) {
+        FIELD(io, apu->ch_reload[i].time);
+        FIELD(io, apu->ch_reload[i].sched_time);
+        FIELD(io, apu->ch_reload[i].after_sample);
+        FIELD(io, apu->ch_reload[i].after_div);
+        FIELD(io, apu->ch_reload[i].active);
+    }
+    FIELD(io, apu->enable_time);
+    FIELD(io, apu->last_sample);
+    FIELD(io, apu->last_div);
+    FIELD(io, apu->tm_add_time);
+    FIELD(io, apu->tm_add_order);
+    FIELD(io, apu->fifo_a_out);
+    FIELD(io, apu->fifo_b_out);
+    FIELD(io, apu->sample_buf);
+    FIELD(io, apu->sample_ind);
+    FIELD(io, apu->samples_full);
+    FIELD(io, apu->blip);
+    FIELD(io, apu->blip_sum);
+    FIELD(io, apu->blip_ind);
+    FIELD(io, apu->psg_level);
+    FIELD(io, apu->direct_level);
+    FIELD(io, apu->last_sync);
+
+    FIELD(io, apu->ch1_enable);
+    FIELD(io, apu->ch1_wavelen);
+    FIELD(io, apu->ch1_duty_index);
+    FIELD(io, apu->ch1_env_counter);
+    FIELD(io, apu->ch1_env_pace);
+    FIELD(io, apu->ch1_env_dir);
+    FIELD(io, apu->ch1_volume);
+    FIELD(io, apu->ch1_len_counter);
+    FIELD(io, apu->ch1_sweep_pace);
+    FIELD(io, apu->ch1_sweep_counter);
+
+    FIELD(io, apu->ch2_enable);
+    FIELD(io, apu->ch2_wavelen);
+    FIELD(io, apu->ch2_duty_index);
+    FIELD(io, apu->ch2_env_counter);
+    FIELD(io, apu->ch2_env_pace);
+    FIELD(io, apu->ch2_env_dir);
+    FIELD(io, apu->ch2_volume);
+    FIELD(io, apu->ch2_len_counter);
+
+    FIELD(io, apu->ch3_enable);
+    FIELD(io, apu->ch3_wavelen);
+    FIELD(io, apu->ch3_sample_index);
+    FIELD(io, apu->ch3_len_counter);
+    FIELD(io, apu->waveram);
+
+    FIELD(io, apu->ch4_enable);
+    FIELD(io, apu->ch4_lfsr);
+    FIELD(io, apu->ch4_env_counter);
+    FIELD(io, apu->ch4_env_pace);
+    FIELD(io, apu->ch4_env_dir);
+    FIELD(io, apu->ch4_volume);
+    FIELD(io, apu->ch4_len_counter);
+
+    FIELD(io, apu->fifo_a);
+    FIELD(io, apu->fifo_b);
+    FIELD(io, apu->fifo_a_size);
+    FIELD(io, apu->fifo_b_size);
+}
+
+static void dma_state(StateIO* io, GBA* gba) {
+    DMAController* dmac = &gba->dmac;
+    for (int i = 0; i < 4; i++) {
+        FIELD(io, dmac->dma[i].sptr);
+        FIELD(io, dmac->dma[i].dptr);
+        FIELD(io, dmac->dma[i].bus_val);
+        FIELD(io, dmac->dma[i].ct);
+        FIELD(io, dmac->dma[i].sound);
+        FIELD(io, dmac->dma[i].initial);
+        FIELD(io, dmac->dma[i].waiting);
+    }
+    FIELD(io, dmac->active_dma);
+}
+
+static void timer_state(StateIO* io, GBA* gba) {
+    TimerController* tmc = &gba->tmc;
+    FIELD(io, tmc->set_time);
+    FIELD(io, tmc->counter);
+    FIELD(io, tmc->ena_count);
+    FIELD(io, tmc->written_cnt_h);
+    FIELD(io, tmc->written_cnt_l);
+}
+
+static void io_state(StateIO* io, GBA* gba) {
+    FIELD(io, gba->io.b);
+}
+
+// the whole queue is written so the size does not depend on what is in it
+static void sched_state(StateIO* io, GBA* gba) {
+    Scheduler* sched = &gba->sched;
+    FIELD(io, sched->now);
+    for (int i = 0; i < EVENT_MAX; i++) {
+        Event* e = &sched->event_queue[i];
+        FIELD(io, e->time);
+        FIELD(io, e->id);
+        FIELD(io, e->type);
+    }
+    FIELD(io, sched->n_events);
+    FIELD(io, sched->next_id);
+}
+
+// the wait tables are rebuilt from waitcnt
+static void bus_state(StateIO* io, GBA* gba) {
+    FIELD(io, gba->next_prefetch_addr);
+    FIELD(io, gba->prefetcher_cycles);
+    FIELD(io, gba->prefetch_halted);
+    FIELD(io, gba->last_bios_val);
+    FIELD(io, gba->halt);
+    FIELD(io, gba->stop);
+    FIELD(io, gba->bus_locks);
+    FIELD(io, gba->openbus);
+}
+
+static void mem_state(StateIO* io, GBA* gba) {
+    FIELD(io, gba->ewram.b);
+    FIELD(io, gba->iwram.b);
+    FIELD(io, gba->pram.b);
+    FIELD(io, gba->vram.b);
+    FIELD(io, gba->oam.b);
+}
+
+// the save type and everything else found by scanning the rom is left to the
+// cartridge
+static void cart_state(StateIO* io, GBA* gba) {
+    Cartridge* cart = gba->cart;
+    if (cart->sav_type == SAV_FLASH) {
+        FIELD(io, cart->st.flash.mode);
+        FIELD(io, cart->st.flash.state);
+        FIELD(io, cart->st.flash.bank);
+    } else if (cart->sav_type == SAV_EEPROM) {
+        FIELD(io, cart->big_eeprom);
+        FIELD(io, cart->eeprom_size_set);
+        FIELD(io, cart->eeprom_addr_len);
+        FIELD(io, cart->st.eeprom.state);
+        FIELD(io, cart->st.eeprom.data);
+        FIELD(io, cart->st.eeprom.addr);
+        FIELD(io, cart->st.eeprom.index);
+        FIELD(io, cart->st.eeprom.read);
+    }
+}
+
+static void sram_state(StateIO* io, GBA* gba) {
+    Cartridge* cart = gba->cart;
+    if (cart->sav_size) state_field(io, cart->sram, cart->sav_size);
+}
+
+static const struct {
+    char tag[5];
+    void (*func)(StateIO* io, GBA* gba);
+} sections[] = {
+    {"CPU ", cpu_state},   {"PPU ", ppu_state},   {"APU ", apu_state},
+    {"DMA ", dma_state},   {"TMR ", timer_state}, {"IO  ", io_state},
+    {"SCHD", sched_state}, {"BUS ", bus_state},   {"MEM ", mem_state},
+    {"CART", cart_state},  {"SAVE", sram_state},
+};
+
+#define N_SECTIONS (sizeof sections / sizeof sections[0])
+
+static size_t section_size(int i, GBA* gba) {
+    StateIO io = {0};
+    sections[i].func(&io, gba);
+    return io.size;
+}
+
+size_t gba_serialize(GBA* gba, void* buf, size_t size) {
+    size_t total = sizeof(StateHeader);
+    for (int i = 0; i < N_SECTIONS; i++) {
+        total += sizeof(StateSection) + section_size(i, gba);
+    }
+    if (!buf || size < total) return total;
+
+    if (gba->renderer) renderer_sync(gba->renderer);
+    apu_sync(&gba->apu);
+
+    byte* p = buf;
+    StateHeader h = {STATE_MAGIC, STATE_VERSION, total};
+    memcpy(p, &h, sizeof h);
+    p += sizeof h;
+    for (int i = 0; i < N_SECTIONS; i++) {
+        StateSection sec = {TAG(sections[i].tag), section_size(i, gba)};
+        memcpy(p, &sec, sizeof sec);
+        p += sizeof sec;
+        StateIO io = {p, false};
+        sections[i].func(&io, gba);
+        p = io.p;
+    }
+    return total;
+}
+
+bool gba_deserialize(GBA* gba, const void* buf, size_t size) {
+    StateHeader h;
+    if (size < sizeof h) return false;
+    memcpy(&h, buf, sizeof h);
+    if (h.magic != STATE_MAGIC || h.version != STATE_VERSION || h.size > size)
+        return false;
+
+    // find every section before touching anything, unknown ones are skipped
+    const byte* found[N_SECTIONS] = {0};
+    const byte* p = (const byte*) buf + sizeof h;
+    const byte* end = (const byte*) buf + h.size;
+    while (end - p >= sizeof(StateSection)) {
+        StateSection sec;
+        memcpy(&sec, p, sizeof sec);
+        p += sizeof sec;
+        if (sec.size > end - p) return false;
+        for (int i = 0; i < N_SECTIONS; i++) {
+            if (TAG(sections[i].tag) != sec.tag) continue;
+            if (sec.size != section_size(i, gba)) return false;
+            found[i] = p;
+        }
+        p += sec.size;
+    }
+    for (int i = 0; i < N_SECTIONS; i++) {
+        if (!found[i]) return false;
+    }
+
+    if (gba->renderer) renderer_sync(gba->renderer);
+
+    for (int i = 0; i < N_SECTIONS; i++) {
+        StateIO io = {(byte*) found[i], true};
+        sections[i].func(&io, gba);
+    }
+
+    // everything derived from the state is rebuilt, every line is redrawn
+    // since the screen is not part of it
+    gba->apu.fifo_log_len = 0;
+    gba->apu.in_tm_event = false;
+    memset(gba->ppu.linekeys, 0, sizeof gba->ppu.linekeys);
+    gba->ppu.objlist_dirty = true;
+    gba->ppu.screen_changed = true;
+    update_cart_waits(gba);
+    gba_set_ptrs(gba, gba->cart, gba->bios.b);
+    if (gba->renderer) renderer_attach(gba->renderer, gba);
+    return true;
+}
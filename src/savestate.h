@@ -0,0 +1,34 @@
+#ifndef SAVESTATE_H
+#define SAVESTATE_H
+
+#include <stddef.h>
+
+#include "types.h"
+
+#define STATE_MAGIC 0x53424741 // "AGBS"
+// bumped whenever a field is added, removed or changes type
+#define STATE_VERSION 4
+
+typedef struct _GBA GBA;
+
+// a state is a header followed by tagged sections, each holding the fields of
+// one part of the system one after another so the struct layouts do not matter
+typedef struct {
+    word magic;
+    word version;
+    dword size;
+} StateHeader;
+
+typedef struct {
+    word tag;
+    word size;
+} StateSection;
+
+// writes the state of gba and its cartridge to buf if it fits and returns the
+// size of the state either way, the size only depends on the cartridge
+size_t gba_serialize(GBA* gba, void* buf, size_t size);
+// leaves gba alone and returns false if buf is not a state of this version
+// with every section the right size
+bool gba_deserialize(GBA* gba, const void* buf, size_t size);
+
+#endif
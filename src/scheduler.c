@@ -2,13 +2,7 @@
 
 #include <stdio.h>
 
-#include "apu.h"
 #include "gba.h"
-#include "ppu.h"
-#include "timer.h"
-
-void (*apu_events[])(APU*) = {apu_new_sample, ch1_reload, ch2_reload,
-                              ch3_reload,     ch4_reload, apu_div_tick};
 
 void run_scheduler_mem(Scheduler* sched, int cycles) {
     dword end_time = sched->now + cycles;
@@ -38,66 +32,94 @@ void run_scheduler_internal(Scheduler* sched, int cycles) {
     sched->now = end_time;
 }
 
-int run_next_event(Scheduler* sched) {
-    if (sched->n_events == 0) return 0;
+static inline bool event_before(Event* a, Event* b) {
+    return a->time < b->time || (a->time == b->time && a->id < b->id);
+}
 
-    Event e = sched->event_queue[0];
-    sched->n_events--;
-    for (int i = 0; i < sched->n_events; i++) {
-        sched->event_queue[i] = sched->event_queue[i + 1];
+static void sift_up(Scheduler* sched, int i) {
+    Event e = sched->event_queue[i];
+    while (i > 0) {
+        int p = (i - 1) / 2;
+        if (!event_before(&e, &sched->event_queue[p])) break;
+        sched->event_queue[i] = sched->event_queue[p];
+        i = p;
     }
+    sched->event_queue[i] = e;
+}
 
-    sched->now = e.time;
+static void sift_down(Scheduler* sched, int i) {
+    Event e = sched->event_queue[i];
+    while (true) {
+        int c = 2 * i + 1;
+        if (c >= sched->n_events) break;
+        if (c + 1 < sched->n_events &&
+            event_before(&sched->event_queue[c + 1], &sched->event_queue[c]))
+            c++;
+        if (!event_before(&sched->event_queue[c], &e)) break;
+        sched->event_queue[i] = sched->event_queue[c];
+        i = c;
+    }
+    sched->event_queue[i] = e;
+}
 
-    if (e.type < EVENT_TM0_ENA) {
-        reload_timer(&sched->master->tmc, e.type);
-    } else if (e.type < EVENT_TM0_IRQ) {
-        enable_timer(&sched->master->tmc, e.type - EVENT_TM0_ENA);
-    } else if (e.type < EVENT_TM0_WRITE_L) {
-        sched->master->io.ifl.timer |= 1 << (e.type - EVENT_TM0_IRQ);
-    } else if (e.type < EVENT_TM0_WRITE_H) {
-        timer_write_l(&sched->master->io, e.type - EVENT_TM0_WRITE_L);
-    } else if (e.type < EVENT_DMA0) {
-        timer_write_h(&sched->master->io, e.type - EVENT_TM0_WRITE_H);
-    } else if (e.type < EVENT_PPU_HDRAW) {
-        dma_run(&sched->master->dmac, e.type - EVENT_DMA0);
-    } else if (e.type == EVENT_PPU_HDRAW) {
-        ppu_hdraw(&sched->master->ppu);
-    } else if (e.type == EVENT_PPU_HBLANK) {
-        ppu_hblank(&sched->master->ppu);
+static void remove_event_at(Scheduler* sched, int i) {
+    sched->n_events--;
+    if (i == sched->n_events) return;
+    Event last = sched->event_queue[sched->n_events];
+    sched->event_queue[i] = last;
+    if (i > 0 && event_before(&last, &sched->event_queue[(i - 1) / 2])) {
+        sift_up(sched, i);
     } else {
-        apu_events[e.type - EVENT_APU_SAMPLE](&sched->master->apu);
+        sift_down(sched, i);
     }
+}
+
+int run_next_event(Scheduler* sched) {
+    if (sched->n_events == 0) return 0;
+
+    Profiler* prof = sched->master->prof;
+    ProfSection prev = PROF_CPU;
+    if (prof) prev = prof_switch(prof, PROF_SCHED);
+
+    Event e = sched->event_queue[0];
+    remove_event_at(sched, 0);
+
+    sched->now = e.time;
+    EventHandler* h = &sched->handlers[e.type];
+    if (prof) {
+        prof_switch(prof, prof_event_section(e.type));
+        h->func(h->ctx, h->arg);
+        prof_switch(prof, prev);
+    } else h->func(h->ctx, h->arg);
     return sched->now - e.time;
 }
 
+void set_event_handler(Scheduler* sched, EventType t, EventFunc func, void* ctx,
+                       int arg) {
+    sched->handlers[t].func = func;
+    sched->handlers[t].ctx = ctx;
+    sched->handlers[t].arg = arg;
+}
+
 void add_event(Scheduler* sched, EventType t, dword time) {
     if (sched->n_events == EVENT_MAX) return;
 
-    int i = sched->n_events;
-    sched->event_queue[sched->n_events].type = t;
-    sched->event_queue[sched->n_events].time = time;
-    sched->n_events++;
-
-    while (i > 0 &&
-           sched->event_queue[i].time < sched->event_queue[i - 1].time) {
-        Event tmp = sched->event_queue[i - 1];
-        sched->event_queue[i - 1] = sched->event_queue[i];
-        sched->event_queue[i] = tmp;
-        i--;
-    }
+    int i = sched->n_events++;
+    sched->event_queue[i].type = t;
+    sched->event_queue[i].time = time;
+    sched->event_queue[i].id = sched->next_id++;
+    sift_up(sched, i);
 }
 
 void remove_event(Scheduler* sched, EventType t) {
+    int first = -1;
     for (int i = 0; i < sched->n_events; i++) {
-        if (sched->event_queue[i].type == t) {
-            sched->n_events--;
-            for (int j = i; j < sched->n_events; j++) {
-                sched->event_queue[j] = sched->event_queue[j + 1];
-            }
-            return;
-        }
+        if (sched->event_queue[i].type == t &&
+            (first < 0 ||
+             event_before(&sched->event_queue[i], &sched->event_queue[first])))
+            first = i;
     }
+    if (first >= 0) remove_event_at(sched, first);
 }
 
 void print_scheduled_events(Scheduler* sched) {
@@ -105,11 +127,15 @@ void print_scheduled_events(Scheduler* sched) {
         "TM0 reload",     "TM1 reload",     "TM2 reload",     "TM3 reload",
         "TM0 enable",     "TM1 enable",     "TM2 enable",     "TM3 enable",
         "TM0 interrupt",  "TM1 interrupt",  "TM2 interrupt",  "TM3 interrupt",
-        "PPU hdraw",      "PPU hblank",     "APU sample",     "APU reload ch1",
-        "APU reload ch2", "APU reload ch3", "APU reload ch4", "APU DIV tick"};
+        "TM0 write lo",   "TM1 write lo",   "TM2 write lo",   "TM3 write lo",
+        "TM0 write hi",   "TM1 write hi",   "TM2 write hi",   "TM3 write hi",
+        "DMA0",           "DMA1",           "DMA2",           "DMA3",
+        "PPU hdraw",      "PPU hblank",     "APU flush"};
 
-    for (int i = 0; i < sched->n_events; i++) {
-        printf("%ld => %s\n", sched->event_queue[i].time,
-               event_names[sched->event_queue[i].type]);
+    Scheduler tmp = *sched;
+    while (tmp.n_events) {
+        printf("%ld => %s\n", tmp.event_queue[0].time,
+               event_names[tmp.event_queue[0].type]);
+        remove_event_at(&tmp, 0);
     }
 }
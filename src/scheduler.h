@@ -30,29 +30,37 @@ typedef enum {
     EVENT_DMA3,
     EVENT_PPU_HDRAW,
     EVENT_PPU_HBLANK,
-    EVENT_APU_SAMPLE,
-    EVENT_APU_CH1_REL,
-    EVENT_APU_CH2_REL,
-    EVENT_APU_CH3_REL,
-    EVENT_APU_CH4_REL,
-    EVENT_APU_DIV_TICK,
+    EVENT_APU_FLUSH,
     EVENT_MAX
 } EventType;
 
 typedef struct {
     dword time;
+    dword id;
     EventType type;
 } Event;
 
+typedef void (*EventFunc)(void* ctx, int arg);
+
+typedef struct {
+    EventFunc func;
+    void* ctx;
+    int arg;
+} EventHandler;
+
 typedef struct _GBA GBA;
 
 typedef struct {
     GBA* master;
 
+    EventHandler handlers[EVENT_MAX];
+
     dword now;
 
+    // binary min-heap ordered by time, ties broken by insertion order
     Event event_queue[EVENT_MAX];
     int n_events;
+    dword next_id;
 
 } Scheduler;
 
@@ -63,6 +71,9 @@ void run_scheduler_fetch(Scheduler* sched, int cycles);
 
 int run_next_event(Scheduler* sched);
 
+void set_event_handler(Scheduler* sched, EventType t, EventFunc func, void* ctx,
+                       int arg);
+
 void add_event(Scheduler* sched, EventType t, dword time);
 void remove_event(Scheduler* sched, EventType t);
 
@@ -0,0 +1,50 @@
+#include "tile_cache.h"
+
+#include <string.h>
+
+void tcache_reset(TileCache* tc) {
+    memset(tc->valid4, 0, sizeof tc->valid4);
+    memset(tc->valid8, 0, sizeof tc->valid8);
+}
+
+static dword flip_row(dword row) {
+    row = (row & 0xffffffff00000000) >> 32 | (row & 0x00000000ffffffff) << 32;
+    row = (row & 0xffff0000ffff0000) >> 16 | (row & 0x0000ffff0000ffff) << 16;
+    row = (row & 0xff00ff00ff00ff00) >> 8 | (row & 0x00ff00ff00ff00ff) << 8;
+    return row;
+}
+
+void tcache_decode4(TileCache* tc, byte* vram, int tile) {
+    for (int y = 0; y < 8; y++) {
+        word w;
+        memcpy(&w, &vram[32 * tile + 4 * y], 4);
+        // spread the 8 nibbles out into 8 bytes
+        dword row = w;
+        row = (row | row << 16) & 0x0000ffff0000ffff;
+        row = (row | row << 8) & 0x00ff00ff00ff00ff;
+        row = (row | row << 4) & 0x0f0f0f0f0f0f0f0f;
+        tc->rows4[tile][y][0] = row;
+        tc->rows4[tile][y][1] = flip_row(row);
+    }
+    tc->valid4[tile] = true;
+}
+
+void tcache_decode8(TileCache* tc, byte* vram, int tile) {
+    for (int y = 0; y < 8; y++) {
+        dword row;
+        memcpy(&row, &vram[64 * tile + 8 * y], 8);
+        tc->rows8[tile][y][0] = row;
+        tc->rows8[tile][y][1] = flip_row(row);
+    }
+    tc->valid8[tile] = true;
+}
+
+void tcache_write_range(TileCache* tc, word addr, word len) {
+    if (!len || addr >= 0x10000) return;
+    if (addr + len > 0x10000) len = 0x10000 - addr;
+    // every tile the range touches, an unaligned range can reach one more
+    // tile than len alone would say
+    word last = addr + len - 1;
+    memset(&tc->valid4[addr >> 5], 0, (last >> 5) - (addr >> 5) + 1);
+    memset(&tc->valid8[addr >> 6], 0, (last >> 6) - (addr >> 6) + 1);
+}
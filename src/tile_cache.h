@@ -0,0 +1,45 @@
+#ifndef TILE_CACHE_H
+#define TILE_CACHE_H
+
+#include "types.h"
+
+// background tiles live in the first 64kb of vram
+#define TILES_4BPP (0x10000 >> 5)
+#define TILES_8BPP (0x10000 >> 6)
+
+// tile rows decoded to one palette index per byte with the leftmost pixel in
+// the low byte, each row is stored as is and horizontally flipped
+typedef struct {
+    dword rows4[TILES_4BPP][8][2];
+    dword rows8[TILES_8BPP][8][2];
+    bool valid4[TILES_4BPP];
+    bool valid8[TILES_8BPP];
+} TileCache;
+
+void tcache_reset(TileCache* tc);
+
+void tcache_decode4(TileCache* tc, byte* vram, int tile);
+void tcache_decode8(TileCache* tc, byte* vram, int tile);
+
+static inline dword tcache_row4(TileCache* tc, byte* vram, int tile, int y,
+                                bool hflip) {
+    if (!tc->valid4[tile]) tcache_decode4(tc, vram, tile);
+    return tc->rows4[tile][y][hflip];
+}
+
+static inline dword tcache_row8(TileCache* tc, byte* vram, int tile, int y,
+                                bool hflip) {
+    if (!tc->valid8[tile]) tcache_decode8(tc, vram, tile);
+    return tc->rows8[tile][y][hflip];
+}
+
+static inline void tcache_write_vram(TileCache* tc, word addr) {
+    if (addr < 0x10000) {
+        tc->valid4[addr >> 5] = false;
+        tc->valid8[addr >> 6] = false;
+    }
+}
+
+void tcache_write_range(TileCache* tc, word addr, word len);
+
+#endif
@@ -31,6 +31,7 @@ void update_timer_reload(TimerController* tmc, int i) {
         (tmc->set_time[i] + ((0x10000 - tmc->counter[i]) << rate)) &
         ~((1 << rate) - 1);
     add_event(&tmc->master->sched, i, rel_time);
+    apu_timer_scheduled(&tmc->master->apu, i);
 }
 
 void enable_timer(TimerController* tmc, int i) {